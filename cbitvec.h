@@ -0,0 +1,580 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A vector of bits packed into 64-bit words.
+ *
+ * A cvec_t(char) used as a set of flags spends a byte on every flag. A
+ * cbitvec_t spends one bit, and the bulk operations below work on a whole
+ * word at a time:
+ *
+ *    cbitvec_t seen = CBITVEC_INIT;
+ *    cbitvec_resize(seen, 1000000, 0);
+ *    cbitvec_set(seen, 42, 1);
+ *    if (cbitvec_get(seen, 42))
+ *      ...
+ *    for (size_t i = cbitvec_next(seen, 0); i != CVEC_NPOS;
+ *         i = cbitvec_next(seen, i + 1))
+ *      ...
+ *    cbitvec_free(seen);
+ *
+ * cbitvec_rank and cbitvec_select scan the words from the start unless
+ * cbitvec_build_index has been called since the last change, in which case
+ * they use a directory of running counts instead. The directory costs 8
+ * bytes for every 512 bits, plus a little for the select samples.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on bit vectors too.
+ */
+
+#ifndef __CBITVEC_H__
+#define __CBITVEC_H__
+
+#include "cvec.h"
+
+/* The number of bits covered by each entry of the rank directory */
+#define __CBITVEC_BLOCK 512
+
+/* The number of set bits between two select samples */
+#define __CBITVEC_SAMPLE 4096
+
+/* The number of words holding a number of bits */
+#define __CBITVEC_WORDS(__bits) (((__bits) + 63) >> 6)
+
+/*
+ * cbitvec_t: The bit vector type.
+ *
+ * Bits past the size in the last word are always zero.
+ */
+typedef struct
+{
+  uint64_t *__w;
+  size_t __n;
+  size_t __m;
+  int __e;
+  int __idx;
+  uint64_t *__rank;
+  size_t *__sel;
+  size_t __nsel;
+} cbitvec_t;
+
+/*
+ * CBITVEC_INIT: Initializes all the fields of the bit vector struct.
+ */
+#define CBITVEC_INIT                                                          \
+  {                                                                           \
+    NULL, 0, 0, CVEC_EOK, 0, NULL, NULL, 0                                    \
+  }
+
+static inline unsigned
+__cbitvec_popcount(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned) __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (unsigned) ((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/* Returns the number of trailing zero bits in a non-zero x */
+static inline unsigned
+__cbitvec_ctz(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned) __builtin_ctzll(x);
+#else
+  unsigned n = 0;
+  for (; !(x & 1); x >>= 1)
+    ++n;
+  return n;
+#endif
+}
+
+/* Returns the position of the k-th set bit of x, counting from zero */
+static inline unsigned
+__cbitvec_select64(uint64_t x, unsigned k)
+{
+#if defined(__CVEC_X86) && defined(__BMI2__)
+  return __cbitvec_ctz(_pdep_u64((uint64_t) 1 << k, x));
+#else
+  while (k--)
+    x &= x - 1;
+  return __cbitvec_ctz(x);
+#endif
+}
+
+/* Clears the bits past the size in the last word */
+static inline void
+__cbitvec_mask_tail(cbitvec_t *b)
+{
+  if (b->__n & 63)
+    b->__w[b->__n >> 6] &= ((uint64_t) 1 << (b->__n & 63)) - 1;
+}
+
+static inline int
+__cbitvec_reserve(cbitvec_t *b, size_t bits)
+{
+  size_t need = __CBITVEC_WORDS(bits);
+  size_t m = b->__m ? b->__m : 1;
+  uint64_t *w;
+
+  if (need <= b->__m)
+    return 1;
+  while (m < need)
+    m <<= 1;
+  w = realloc(b->__w, m * sizeof(uint64_t));
+  if (!w)
+  {
+    b->__e = CVEC_EOOM;
+    return 0;
+  }
+  b->__w = w;
+  b->__m = m;
+  return 1;
+}
+
+static inline void
+__cbitvec_resize(cbitvec_t *b, size_t bits, int bit)
+{
+  size_t from, words;
+
+  if (!__cbitvec_reserve(b, bits))
+    return;
+  b->__idx = 0;
+  if (bits <= b->__n)
+  {
+    b->__n = bits;
+    __cbitvec_mask_tail(b);
+    return;
+  }
+  from = __CBITVEC_WORDS(b->__n);
+  words = __CBITVEC_WORDS(bits);
+  if (bit && (b->__n & 63))
+    b->__w[b->__n >> 6] |= ~(uint64_t) 0 << (b->__n & 63);
+  memset(b->__w + from, bit ? 0xff : 0, (words - from) * sizeof(uint64_t));
+  b->__n = bits;
+  __cbitvec_mask_tail(b);
+}
+
+static inline void
+__cbitvec_push_back(cbitvec_t *b, int bit)
+{
+  size_t i = b->__n;
+
+  if ((i >> 6) == b->__m && !__cbitvec_reserve(b, i + 1))
+    return;
+  if (!(i & 63))
+    b->__w[i >> 6] = 0;
+  b->__w[i >> 6] |= (uint64_t) !!bit << (i & 63);
+  b->__n = i + 1;
+  b->__idx = 0;
+}
+
+static inline void
+__cbitvec_set(cbitvec_t *b, size_t i, int bit)
+{
+  uint64_t *w = &b->__w[i >> 6];
+  uint64_t mask = (uint64_t) 1 << (i & 63);
+
+  *w ^= (-(uint64_t) !!bit ^ *w) & mask;
+  b->__idx = 0;
+}
+
+static inline size_t
+__cbitvec_count(const cbitvec_t *b)
+{
+  size_t words = __CBITVEC_WORDS(b->__n);
+  size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+  size_t i = 0;
+
+  for (; i + 4 <= words; i += 4)
+  {
+    c0 += __cbitvec_popcount(b->__w[i]);
+    c1 += __cbitvec_popcount(b->__w[i + 1]);
+    c2 += __cbitvec_popcount(b->__w[i + 2]);
+    c3 += __cbitvec_popcount(b->__w[i + 3]);
+  }
+  for (; i < words; ++i)
+    c0 += __cbitvec_popcount(b->__w[i]);
+  return c0 + c1 + c2 + c3;
+}
+
+static inline size_t
+__cbitvec_next(const cbitvec_t *b, size_t from)
+{
+  size_t words = __CBITVEC_WORDS(b->__n);
+  size_t i = from >> 6;
+  uint64_t w;
+
+  if (from >= b->__n)
+    return CVEC_NPOS;
+  w = b->__w[i] & (~(uint64_t) 0 << (from & 63));
+  while (!w)
+  {
+    if (++i == words)
+      return CVEC_NPOS;
+    w = b->__w[i];
+  }
+  return (i << 6) + __cbitvec_ctz(w);
+}
+
+/* The bulk operations, dst = dst OP src over the bits both vectors have */
+#define __CBITVEC_OP(__name, __expr, __clear_rest)                            \
+  static inline void __cbitvec_##__name(cbitvec_t *dst, const cbitvec_t *src) \
+  {                                                                           \
+    size_t dw = __CBITVEC_WORDS(dst->__n);                                    \
+    size_t sw = __CBITVEC_WORDS(src->__n);                                    \
+    size_t n = dw < sw ? dw : sw;                                             \
+    uint64_t *d = dst->__w;                                                   \
+    const uint64_t *s = src->__w;                                             \
+                                                                              \
+    for (size_t i = 0; i < n; ++i)                                            \
+      d[i] = __expr;                                                          \
+    if ((__clear_rest) && dw > n)                                             \
+      memset(d + n, 0, (dw - n) * sizeof(uint64_t));                          \
+    if (dw)                                                                   \
+      __cbitvec_mask_tail(dst);                                               \
+    dst->__idx = 0;                                                           \
+  }
+
+__CBITVEC_OP(and, d[i] & s[i], 1)
+__CBITVEC_OP(or, d[i] | s[i], 0)
+__CBITVEC_OP(xor, d[i] ^ s[i], 0)
+__CBITVEC_OP(andnot, d[i] & ~s[i], 0)
+
+#undef __CBITVEC_OP
+
+static inline void
+__cbitvec_build_index(cbitvec_t *b)
+{
+  size_t words = __CBITVEC_WORDS(b->__n);
+  size_t blocks = (words + 7) >> 3;
+  size_t nsel = 0, ones = 0;
+  uint64_t *rank;
+  size_t *sel;
+
+  rank = realloc(b->__rank, (blocks + 1) * sizeof(uint64_t));
+  if (!rank)
+  {
+    b->__e = CVEC_EOOM;
+    return;
+  }
+  b->__rank = rank;
+  for (size_t k = 0; k < blocks; ++k)
+  {
+    size_t end = (k << 3) + 8 < words ? (k << 3) + 8 : words;
+
+    rank[k] = ones;
+    for (size_t i = k << 3; i < end; ++i)
+      ones += __cbitvec_popcount(b->__w[i]);
+  }
+  rank[blocks] = ones;
+
+  nsel = (ones + __CBITVEC_SAMPLE - 1) / __CBITVEC_SAMPLE;
+  sel = realloc(b->__sel, (nsel ? nsel : 1) * sizeof(size_t));
+  if (!sel)
+  {
+    b->__e = CVEC_EOOM;
+    return;
+  }
+  b->__sel = sel;
+  b->__nsel = nsel;
+  for (size_t k = 0, j = 0; j < nsel; ++k)
+    while (j < nsel && rank[k + 1] > j * __CBITVEC_SAMPLE)
+      sel[j++] = k;
+  b->__idx = 1;
+}
+
+static inline size_t
+__cbitvec_rank(const cbitvec_t *b, size_t pos)
+{
+  size_t r = 0, i = 0;
+
+  if (pos > b->__n)
+    pos = b->__n;
+  if (b->__idx)
+  {
+    r = (size_t) b->__rank[pos / __CBITVEC_BLOCK];
+    i = (pos / __CBITVEC_BLOCK) << 3;
+  }
+  for (; i < (pos >> 6); ++i)
+    r += __cbitvec_popcount(b->__w[i]);
+  if (pos & 63)
+    r += __cbitvec_popcount(b->__w[i] & (((uint64_t) 1 << (pos & 63)) - 1));
+  return r;
+}
+
+static inline size_t
+__cbitvec_select(const cbitvec_t *b, size_t k)
+{
+  size_t words = __CBITVEC_WORDS(b->__n);
+  size_t i = 0;
+  unsigned c;
+
+  if (b->__idx)
+  {
+    size_t blocks = (words + 7) >> 3;
+    size_t s = k / __CBITVEC_SAMPLE;
+    size_t lo, hi;
+
+    if (k >= b->__rank[blocks])
+      return CVEC_NPOS;
+    lo = b->__sel[s];
+    hi = s + 1 < b->__nsel ? b->__sel[s + 1] + 1 : blocks;
+    while (hi - lo > 1)
+    {
+      size_t mid = lo + ((hi - lo) >> 1);
+
+      if (b->__rank[mid] <= k)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    k -= (size_t) b->__rank[lo];
+    i = lo << 3;
+  }
+  for (; i < words; ++i)
+  {
+    c = __cbitvec_popcount(b->__w[i]);
+    if (k < c)
+      return (i << 6) + __cbitvec_select64(b->__w[i], (unsigned) k);
+    k -= c;
+  }
+  return CVEC_NPOS;
+}
+
+/*
+ * cbitvec_free: Deallocates all the memory associated with this bit vector.
+ *
+ * __b: The bit vector.
+ */
+#define cbitvec_free(__b)                                                     \
+  do                                                                          \
+  {                                                                           \
+    free((__b).__w);                                                          \
+    free((__b).__rank);                                                       \
+    free((__b).__sel);                                                        \
+    memset(&(__b), 0, sizeof(__b));                                           \
+  } while (0)
+
+/*
+ * cbitvec_clear: Remove all the bits without releasing any memory.
+ *
+ * __b: The bit vector.
+ */
+#define cbitvec_clear(__b)                                                    \
+  do                                                                          \
+  {                                                                           \
+    (__b).__n = 0;                                                            \
+    (__b).__idx = 0;                                                          \
+  } while (0)
+
+/*
+ * cbitvec_reserve: Reserve memory ahead of time.
+ *
+ * __b:    The bit vector.
+ * __bits: The number of bits to make room for.
+ */
+#define cbitvec_reserve(__b, __bits) (void) __cbitvec_reserve(&(__b), (__bits))
+
+/*
+ * cbitvec_resize: Change the number of bits.
+ *
+ * __b:    The bit vector.
+ * __bits: The new number of bits.
+ * __bit:  The value of any bits added at the end.
+ */
+#define cbitvec_resize(__b, __bits, __bit)                                    \
+  __cbitvec_resize(&(__b), (__bits), (__bit))
+
+/*
+ * cbitvec_push_back: Add a bit to the end of the bit vector.
+ *
+ * __b:   The bit vector.
+ * __bit: The bit to add. Any non-zero value adds a set bit.
+ */
+#define cbitvec_push_back(__b, __bit) __cbitvec_push_back(&(__b), (__bit))
+
+/*
+ * cbitvec_pop_back: Remove the last bit of the bit vector.
+ *
+ * __b: The bit vector.
+ */
+#define cbitvec_pop_back(__b)                                                 \
+  do                                                                          \
+  {                                                                           \
+    if ((__b).__n > 0)                                                        \
+    {                                                                         \
+      __cbitvec_set(&(__b), (__b).__n - 1, 0);                                \
+      --(__b).__n;                                                            \
+    }                                                                         \
+  } while (0)
+
+/*
+ * cbitvec_get: Returns the bit at an index as 0 or 1.
+ *
+ * __b: The bit vector.
+ * __i: The index of the bit.
+ *
+ * Note that no bounds checking is performed here.
+ */
+#define cbitvec_get(__b, __i)                                                 \
+  ((int) (((__b).__w[(__i) >> 6] >> ((__i) & 63)) & 1))
+
+/*
+ * cbitvec_set: Set or clear the bit at an index.
+ *
+ * __b:   The bit vector.
+ * __i:   The index of the bit.
+ * __bit: The new value. Any non-zero value sets the bit.
+ *
+ * Note that no bounds checking is performed here.
+ */
+#define cbitvec_set(__b, __i, __bit) __cbitvec_set(&(__b), (__i), (__bit))
+
+/*
+ * cbitvec_and: Clear every bit of __dst that is not set in __src.
+ *
+ * __dst: The bit vector to modify.
+ * __src: The other bit vector.
+ *
+ * The size of __dst does not change. Bits of __dst past the end of __src
+ * are cleared.
+ */
+#define cbitvec_and(__dst, __src) __cbitvec_and(&(__dst), &(__src))
+
+/*
+ * cbitvec_or: Set every bit of __dst that is set in __src.
+ *
+ * __dst: The bit vector to modify.
+ * __src: The other bit vector.
+ *
+ * The size of __dst does not change, so bits of __src past its end are
+ * ignored.
+ */
+#define cbitvec_or(__dst, __src) __cbitvec_or(&(__dst), &(__src))
+
+/*
+ * cbitvec_xor: Flip every bit of __dst that is set in __src.
+ *
+ * __dst: The bit vector to modify.
+ * __src: The other bit vector.
+ *
+ * The size of __dst does not change, so bits of __src past its end are
+ * ignored.
+ */
+#define cbitvec_xor(__dst, __src) __cbitvec_xor(&(__dst), &(__src))
+
+/*
+ * cbitvec_andnot: Clear every bit of __dst that is set in __src.
+ *
+ * __dst: The bit vector to modify.
+ * __src: The other bit vector.
+ *
+ * The size of __dst does not change, so bits of __src past its end are
+ * ignored.
+ */
+#define cbitvec_andnot(__dst, __src) __cbitvec_andnot(&(__dst), &(__src))
+
+/*
+ * cbitvec_count: Returns the number of set bits.
+ *
+ * __b: The bit vector.
+ */
+#define cbitvec_count(__b) __cbitvec_count(&(__b))
+
+/*
+ * cbitvec_next: Returns the index of the first set bit at or after __from.
+ *
+ * __b:    The bit vector.
+ * __from: The index to start looking at.
+ *
+ * If there is no such bit, this will return CVEC_NPOS.
+ */
+#define cbitvec_next(__b, __from) __cbitvec_next(&(__b), (__from))
+
+/*
+ * cbitvec_foreach: Calls a function with the index of each set bit.
+ *
+ * __b:        The bit vector.
+ * __fun:      A callback function to be called on each index with the
+ *             following signature:
+ *                 void <func>(size_t index, void *userdata);
+ * __userdata: Any userdata to be passed along to the callback function.
+ */
+#define cbitvec_foreach(__b, __fun, __userdata)                               \
+  do                                                                          \
+  {                                                                           \
+    size_t __nw = __CBITVEC_WORDS((__b).__n);                                 \
+    for (size_t __i = 0; __i < __nw; ++__i)                                   \
+      for (uint64_t __w = (__b).__w[__i]; __w; __w &= __w - 1)                \
+        __fun((__i << 6) + __cbitvec_ctz(__w), (__userdata));                 \
+  } while (0)
+
+/*
+ * cbitvec_build_index: Build the rank and select directory.
+ *
+ * __b: The bit vector.
+ *
+ * The directory is dropped by any change to the bits, so build it after
+ * the last change and before a run of rank and select calls.
+ */
+#define cbitvec_build_index(__b) __cbitvec_build_index(&(__b))
+
+/*
+ * cbitvec_rank: Returns the number of set bits before an index.
+ *
+ * __b:   The bit vector.
+ * __pos: The index. Values past the end count every set bit.
+ */
+#define cbitvec_rank(__b, __pos) __cbitvec_rank(&(__b), (__pos))
+
+/*
+ * cbitvec_select: Returns the index of a set bit by its rank.
+ *
+ * __b: The bit vector.
+ * __k: The number of set bits before the one to find.
+ *
+ * If there are not that many set bits, this will return CVEC_NPOS.
+ */
+#define cbitvec_select(__b, __k) __cbitvec_select(&(__b), (__k))
+
+/*
+ * cbitvec_size: Returns the total number of bits in the bit vector.
+ *
+ * __b: The bit vector.
+ */
+#define cbitvec_size(__b) (__b).__n
+
+/*
+ * cbitvec_empty: Returns whether or not the bit vector is empty.
+ *
+ * __b: The bit vector.
+ */
+#define cbitvec_empty(__b) ((__b).__n == 0)
+
+#endif /* __CBITVEC_H__ */
@@ -0,0 +1,504 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/*
+ * A sorted map stored as two parallel cvec_t columns, one of keys and one
+ * of values. Lookups are a binary search over the contiguous keys, which
+ * suits tables that are read far more often than they are changed. Large
+ * updates should go through cflatmap_insert_batch, which merges a whole
+ * batch in one pass instead of shifting the columns once per key.
+ *
+ * Keys are ordered by a qsort style comparison function and passed by
+ * address, the same way as cmap_t:
+ *
+ *    cflatmap_t(uint32_t, int) m =
+ *        CFLATMAP_INIT(uint32_t, int, -1, cflatmap_cmp_u32, NULL);
+ *    uint32_t k = 42;
+ *    cflatmap_put(m, &k, 7);
+ *    int v = cflatmap_get(m, &k);
+ *    ...
+ *    cflatmap_free(m);
+ *
+ * The value column keeps the sentinel value in its first item, so the value
+ * of entry i is item i + 1. Use cflatmap_key_at and cflatmap_val_at rather
+ * than the columns directly.
+ */
+
+#ifndef __CFLATMAP_H__
+#define __CFLATMAP_H__
+
+#include "cvec.h"
+
+/*
+ * cflatmap_t: Declare a new sorted map type.
+ *
+ * __K: The type of keys.
+ * __V: The type of values.
+ */
+#define cflatmap_t(__K, __V)                                                  \
+  struct                                                                      \
+  {                                                                           \
+    cvec_t(__K) __keys;                                                       \
+    cvec_t(__V) __vals;                                                       \
+    int (*__cmp)(const void *, const void *);                                 \
+    void (*__on_free)(__K, __V);                                              \
+    int __e;                                                                  \
+    __V __sentinel;                                                           \
+  }
+
+/*
+ * CFLATMAP_INIT: Initializes all the fields of the map struct.
+ *
+ * __K:              The type of keys.
+ * __V:              The type of values.
+ * __sentinel_value: A value returned by cflatmap_get for missing keys.
+ * __cmp:            A function comparing two keys, with the following
+ *                   signature:
+ *                       int <func>(const void *a, const void *b);
+ *                   It returns a negative, zero or positive value like the
+ *                   comparison function of qsort.
+ * __on_free:        A function to be called on each key and value of the
+ *                   map when they are destroyed.
+ */
+#define CFLATMAP_INIT(__K, __V, __sentinel_value, __cmp, __on_free)           \
+  {                                                                           \
+    {.__t = sizeof(__K)},                                                     \
+        {0, 0, sizeof(__V), NULL, NULL, CVEC_EOK, (__sentinel_value), NULL},  \
+        (__cmp), (__on_free), CVEC_EOK, (__sentinel_value)                    \
+  }
+
+/*
+ * cflatmap_init: Initializes all the fields of the map struct.
+ *
+ * __m:              The map to initialize.
+ * __K:              The type of keys.
+ * __V:              The type of values.
+ * __sentinel_value: A value returned by cflatmap_get for missing keys.
+ * __cmp_fn:         A function comparing two keys.
+ * __free_fn:        A function to be called on each key and value of the
+ *                   map when they are destroyed.
+ */
+#define cflatmap_init(__m, __K, __V, __sentinel_value, __cmp_fn,              \
+                      __free_fn)                                              \
+  do                                                                          \
+  {                                                                           \
+    memset(&(__m).__keys, 0, sizeof((__m).__keys));                           \
+    (__m).__keys.__t = sizeof(__K);                                           \
+    cvec_init((__m).__vals, __V, (__sentinel_value), NULL);                   \
+    (__m).__cmp = (__cmp_fn);                                                 \
+    (__m).__on_free = (__free_fn);                                            \
+    (__m).__e = CVEC_EOK;                                                     \
+    (__m).__sentinel = (__sentinel_value);                                    \
+  } while (0)
+
+/* Comparison functions for common key types */
+static inline int
+cflatmap_cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+static inline int
+cflatmap_cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+/* For keys of type char * (or const char *) holding NUL terminated strings */
+static inline int
+cflatmap_cmp_str(const void *a, const void *b)
+{
+  return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+/*
+ * Returns the position of the first of the n keys that is not less than
+ * key. The loop only narrows a base position, so the compiler can use a
+ * conditional move instead of a branch that mispredicts half the time.
+ */
+static inline size_t
+__cflatmap_lower_bound(const void *keys, size_t n, size_t ks, const void *key,
+                       int (*cmp)(const void *, const void *))
+{
+  const unsigned char *k = keys;
+  size_t base = 0;
+  if (n == 0)
+    return 0;
+  while (n > 1)
+  {
+    size_t half = n / 2;
+    base = cmp(k + (base + half) * ks, key) < 0 ? base + half : base;
+    n -= half;
+  }
+  return base + (cmp(k + base * ks, key) < 0);
+}
+
+/* Returns the position of key, or CVEC_NPOS if it is not present */
+static inline size_t
+__cflatmap_find(const void *keys, size_t n, size_t ks, const void *key,
+                int (*cmp)(const void *, const void *))
+{
+  size_t i = __cflatmap_lower_bound(keys, n, ks, key, cmp);
+  if (i < n && cmp((const unsigned char *) keys + i * ks, key) == 0)
+    return i;
+  return CVEC_NPOS;
+}
+
+/*
+ * Stores in ord the positions 0 to n - 1 ordered by the keys at those
+ * positions, keeping equal keys in their original order. tmp must have
+ * room for n positions. Short runs are insertion sorted and then merged
+ * bottom up.
+ */
+static inline void
+__cflatmap_sort_index(size_t *ord, size_t *tmp, size_t n, const void *keys,
+                      size_t ks, int (*cmp)(const void *, const void *))
+{
+  const unsigned char *k = keys;
+  size_t *src = ord;
+  size_t *dst = tmp;
+  for (size_t i = 0; i < n; ++i)
+  {
+    size_t j = i;
+    for (; j > 0 && j % 16 && cmp(k + ord[j - 1] * ks, k + i * ks) > 0; --j)
+      ord[j] = ord[j - 1];
+    ord[j] = i;
+  }
+  for (size_t w = 16; w < n; w *= 2)
+  {
+    size_t *t;
+    for (size_t lo = 0; lo < n; lo += 2 * w)
+    {
+      size_t mid = lo + w < n ? lo + w : n;
+      size_t hi = lo + 2 * w < n ? lo + 2 * w : n;
+      size_t a = lo, b = mid, o = lo;
+      while (a < mid && b < hi)
+        dst[o++] = cmp(k + src[b] * ks, k + src[a] * ks) < 0 ? src[b++]
+                                                             : src[a++];
+      while (a < mid)
+        dst[o++] = src[a++];
+      while (b < hi)
+        dst[o++] = src[b++];
+    }
+    t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != ord)
+    memcpy(ord, src, n * sizeof(size_t));
+}
+
+/*
+ * A private macro that makes room for __need entries in both columns and
+ * sets __ok. The first allocation also stores the sentinel slot.
+ */
+#define __cflatmap_grow(__m, __need, __ok)                                    \
+  do                                                                          \
+  {                                                                           \
+    (__ok) = 0;                                                               \
+    do                                                                        \
+    {                                                                         \
+      __cvec_grow_to((__m).__keys, (__need));                                 \
+      __cvec_grow_to((__m).__vals, (__need) + 1);                             \
+      if ((__m).__vals.__n == 0)                                              \
+      {                                                                       \
+        (__m).__vals.__data[0] = (__m).__sentinel;                            \
+        (__m).__vals.__n = 1;                                                 \
+      }                                                                       \
+      (__ok) = 1;                                                             \
+    } while (0);                                                              \
+    if (!(__ok))                                                              \
+      (__m).__e = CVEC_EOOM;                                                  \
+  } while (0)
+
+/*
+ * cflatmap_free: Deallocates all the memory associated with this map.
+ *
+ * __m: The map.
+ *
+ * If __on_free is not null, then it is called on each key and value in the
+ * map.
+ */
+#define cflatmap_free(__m)                                                    \
+  do                                                                          \
+  {                                                                           \
+    if ((__m).__on_free)                                                      \
+      for (size_t __i = 0; __i < (__m).__keys.__n; ++__i)                     \
+        (__m).__on_free((__m).__keys.__data[__i],                             \
+                        (__m).__vals.__data[__i + 1]);                        \
+    cvec_free((__m).__keys);                                                  \
+    cvec_free((__m).__vals);                                                  \
+    (__m).__e = CVEC_EOK;                                                     \
+  } while (0)
+
+/*
+ * cflatmap_clear: Remove every entry from a map.
+ *
+ * __m: The map.
+ *
+ * If __on_free is not null, then it is called on each key and value
+ * currently in the map. Also note that the capacity of the map is left
+ * unchanged.
+ */
+#define cflatmap_clear(__m)                                                   \
+  do                                                                          \
+  {                                                                           \
+    if ((__m).__on_free)                                                      \
+      for (size_t __i = 0; __i < (__m).__keys.__n; ++__i)                     \
+        (__m).__on_free((__m).__keys.__data[__i],                             \
+                        (__m).__vals.__data[__i + 1]);                        \
+    (__m).__keys.__n = 0;                                                     \
+    if ((__m).__vals.__n)                                                     \
+      (__m).__vals.__n = 1;                                                   \
+  } while (0)
+
+/*
+ * cflatmap_reserve: Reserve memory ahead of time.
+ *
+ * __m: The map.
+ * __n: The number of entries to make room for.
+ */
+#define cflatmap_reserve(__m, __n)                                            \
+  do                                                                          \
+  {                                                                           \
+    int __ok;                                                                 \
+    __cflatmap_grow(__m, (__n), __ok);                                        \
+  } while (0)
+
+/*
+ * cflatmap_put: Insert a key and value into a map, or replace the value of
+ *               a key that is already present.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ * __val: The value.
+ *
+ * This shifts every later entry, so prefer cflatmap_insert_batch for more
+ * than a few keys. When a key is replaced, __on_free is called on the old
+ * key and value if it is not null.
+ */
+#define cflatmap_put(__m, __key, __val)                                       \
+  do                                                                          \
+  {                                                                           \
+    int __ok;                                                                 \
+    size_t __s;                                                               \
+    __cflatmap_grow(__m, (__m).__keys.__n + 1, __ok);                         \
+    if (!__ok)                                                                \
+      break;                                                                  \
+    __s = __cflatmap_lower_bound((__m).__keys.__data, (__m).__keys.__n,       \
+                                 (__m).__keys.__t, (__key), (__m).__cmp);     \
+    if (__s < (__m).__keys.__n &&                                             \
+        (__m).__cmp((__m).__keys.__data + __s, (__key)) == 0)                 \
+    {                                                                         \
+      if ((__m).__on_free)                                                    \
+        (__m).__on_free((__m).__keys.__data[__s],                             \
+                        (__m).__vals.__data[__s + 1]);                        \
+      (__m).__keys.__data[__s] = *(__key);                                    \
+      (__m).__vals.__data[__s + 1] = (__val);                                 \
+      break;                                                                  \
+    }                                                                         \
+    cvec_insert((__m).__keys, __s, *(__key));                                 \
+    cvec_insert((__m).__vals, __s + 1, (__val));                              \
+  } while (0)
+
+/*
+ * cflatmap_insert_batch: Insert many keys and values into a map at once.
+ *
+ * __m:     The map.
+ * __bkeys: A pointer to __count keys, in any order.
+ * __bvals: A pointer to __count values, in the same order as __bkeys.
+ * __count: The number of keys and values.
+ *
+ * The batch is sorted by key and merged into the map from the back in a
+ * single pass, so the cost is that of sorting the batch plus one move of
+ * the map. A key that is already present, or that occurs again later in
+ * the batch, has its value replaced, and __on_free is called on the
+ * replaced key and value if it is not null.
+ */
+#define cflatmap_insert_batch(__m, __bkeys, __bvals, __count)                 \
+  do                                                                          \
+  {                                                                           \
+    size_t __c = (__count);                                                   \
+    size_t __n = (__m).__keys.__n;                                            \
+    size_t __i = __n, __j = __c, __w = __n + __c;                             \
+    size_t *__ord;                                                            \
+    int __ok;                                                                 \
+    if (__c == 0)                                                             \
+      break;                                                                  \
+    __cflatmap_grow(__m, __n + __c, __ok);                                    \
+    if (!__ok)                                                                \
+      break;                                                                  \
+    __ord = malloc(2 * __c * sizeof(size_t));                                 \
+    if (!__ord)                                                               \
+    {                                                                         \
+      (__m).__e = CVEC_EOOM;                                                  \
+      break;                                                                  \
+    }                                                                         \
+    __cflatmap_sort_index(__ord, __ord + __c, __c, (__bkeys),                 \
+                          (__m).__keys.__t, (__m).__cmp);                     \
+    while (__j > 0)                                                           \
+    {                                                                         \
+      size_t __b = __ord[--__j];                                              \
+      int __r = 1;                                                            \
+      while (__j > 0 && (__m).__cmp((__bkeys) + __ord[__j - 1],               \
+                                    (__bkeys) + __b) == 0)                    \
+      {                                                                       \
+        --__j;                                                                \
+        if ((__m).__on_free)                                                  \
+          (__m).__on_free((__bkeys)[__ord[__j]], (__bvals)[__ord[__j]]);      \
+      }                                                                       \
+      while (__i > 0 && (__r = (__m).__cmp((__m).__keys.__data + (__i - 1),   \
+                                           (__bkeys) + __b)) > 0)             \
+      {                                                                       \
+        --__i;                                                                \
+        --__w;                                                                \
+        (__m).__keys.__data[__w] = (__m).__keys.__data[__i];                  \
+        (__m).__vals.__data[__w + 1] = (__m).__vals.__data[__i + 1];          \
+      }                                                                       \
+      if (__i > 0 && __r == 0)                                                \
+      {                                                                       \
+        --__i;                                                                \
+        if ((__m).__on_free)                                                  \
+          (__m).__on_free((__m).__keys.__data[__i],                           \
+                          (__m).__vals.__data[__i + 1]);                      \
+      }                                                                       \
+      --__w;                                                                  \
+      (__m).__keys.__data[__w] = (__bkeys)[__b];                              \
+      (__m).__vals.__data[__w + 1] = (__bvals)[__b];                          \
+    }                                                                         \
+    free(__ord);                                                              \
+    /* Replaced keys leave a gap between the untouched and merged parts */    \
+    if (__w > __i)                                                            \
+    {                                                                         \
+      memmove((__m).__keys.__data + __i, (__m).__keys.__data + __w,           \
+              (__m).__keys.__t * (__n + __c - __w));                          \
+      memmove((__m).__vals.__data + __i + 1, (__m).__vals.__data + __w + 1,   \
+              (__m).__vals.__t * (__n + __c - __w));                          \
+    }                                                                         \
+    (__m).__keys.__n = __i + (__n + __c - __w);                               \
+    (__m).__vals.__n = (__m).__keys.__n + 1;                                  \
+  } while (0)
+
+/*
+ * cflatmap_lower_bound: Returns the position of the first entry in a map
+ *                       whose key is not less than a key.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ *
+ * Together with cflatmap_key_at and cflatmap_val_at, this can be used to
+ * walk the entries in a range of keys.
+ */
+#define cflatmap_lower_bound(__m, __key)                                      \
+  __cflatmap_lower_bound((__m).__keys.__data, (__m).__keys.__n,               \
+                         (__m).__keys.__t, (__key), (__m).__cmp)
+
+/*
+ * cflatmap_get: Returns the value of a key in a map.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ *
+ * If the key is not present, this will return the sentinel value provided
+ * during initialization.
+ */
+#define cflatmap_get(__m, __key)                                              \
+  ((__m).__vals.__n                                                           \
+       ? (__m).__vals.__data[__cflatmap_find((__m).__keys.__data,             \
+                                             (__m).__keys.__n,                \
+                                             (__m).__keys.__t, (__key),       \
+                                             (__m).__cmp) + 1]                \
+       : (__m).__sentinel)
+
+/*
+ * cflatmap_contains: Returns whether or not a key is present in a map.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ */
+#define cflatmap_contains(__m, __key)                                         \
+  (__cflatmap_find((__m).__keys.__data, (__m).__keys.__n, (__m).__keys.__t,   \
+                   (__key), (__m).__cmp) != CVEC_NPOS)
+
+/*
+ * cflatmap_erase: Remove a key and its value from a map.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ *
+ * Nothing happens if the key is not present. If __on_free is not null, then
+ * it is called on the removed key and value.
+ */
+#define cflatmap_erase(__m, __key)                                            \
+  do                                                                          \
+  {                                                                           \
+    size_t __s = __cflatmap_find((__m).__keys.__data, (__m).__keys.__n,       \
+                                 (__m).__keys.__t, (__key), (__m).__cmp);     \
+    if (__s == CVEC_NPOS)                                                     \
+      break;                                                                  \
+    if ((__m).__on_free)                                                      \
+      (__m).__on_free((__m).__keys.__data[__s],                               \
+                      (__m).__vals.__data[__s + 1]);                          \
+    cvec_erase_range((__m).__keys, __s, __s + 1);                             \
+    cvec_erase_range((__m).__vals, __s + 1, __s + 2);                         \
+  } while (0)
+
+/*
+ * cflatmap_key_at: Returns the key of the entry at a position in a map.
+ *
+ * __m: The map.
+ * __i: The position of the entry, in ascending order of keys.
+ *
+ * Note that no bounds checking is performed here.
+ */
+#define cflatmap_key_at(__m, __i) (__m).__keys.__data[(__i)]
+
+/*
+ * cflatmap_val_at: Returns the value of the entry at a position in a map.
+ *
+ * __m: The map.
+ * __i: The position of the entry, in ascending order of keys.
+ *
+ * Note that no bounds checking is performed here.
+ */
+#define cflatmap_val_at(__m, __i) (__m).__vals.__data[(__i) + 1]
+
+/*
+ * cflatmap_size: Returns the total number of entries in the map.
+ *
+ * __m: The map.
+ */
+#define cflatmap_size(__m) (__m).__keys.__n
+
+/*
+ * cflatmap_empty: Returns whether or not the map is empty.
+ *
+ * __m: The map.
+ */
+#define cflatmap_empty(__m) ((__m).__keys.__n == 0)
+
+#endif /* __CFLATMAP_H__ */
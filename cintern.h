@@ -0,0 +1,423 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A string interning table.
+ *
+ * Interning a string returns a 32-bit id that is the same for every string
+ * with the same bytes, so a vector of ids can stand in for a vector of
+ * strings at half the size, and comparing or hashing two interned strings
+ * becomes comparing or hashing two integers. Each distinct string is stored
+ * once, in a cstrvec_t whose index is the id, and an open addressing table
+ * of ids finds them again. The hash of every string is kept next to it, so
+ * probes compare bytes only when the hashes match and growing the table
+ * never rehashes a string:
+ *
+ *    cintern_t syms = CINTERN_INIT;
+ *    uint32_t a = cintern_id_str(syms, "GET");
+ *    uint32_t b = cintern_id(syms, buf, len);
+ *    if (a == b)
+ *      ...
+ *    puts(cintern_str(syms, a));
+ *    cintern_free(syms);
+ *
+ * Ids are dense, starting at zero, and never change. Pointers returned by
+ * cintern_str stay valid until the next new string is interned.
+ *
+ * cintern_sync_t splits the table into stripes by hash, each with its own
+ * lock, so threads interning different strings rarely wait for each other.
+ * It needs C11 atomics or the GCC/Clang __atomic builtins.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on interning tables too.
+ */
+
+#ifndef __CINTERN_H__
+#define __CINTERN_H__
+
+#include "cstrvec.h"
+
+/* The id returned when a string is not found or memory runs out */
+#define CINTERN_NONE UINT32_MAX
+
+/*
+ * cintern_t: The interning table type.
+ *
+ * __slots holds id + 1 for each used slot and 0 for empty ones, and the
+ * table is kept at most half full.
+ */
+typedef struct
+{
+  cstrvec_t __strs;
+  cvec_t(uint32_t) __hashes;
+  uint32_t *__slots;
+  size_t __cap;
+  int __e;
+} cintern_t;
+
+/*
+ * CINTERN_INIT: Initializes all the fields of the interning table struct.
+ */
+#define CINTERN_INIT                                                          \
+  {                                                                           \
+    CSTRVEC_INIT, CVEC_INIT(uint32_t, 0, NULL), NULL, 0, CVEC_EOK             \
+  }
+
+/* FNV-1a, folded to 32 bits */
+static inline uint32_t
+__cintern_hash(const char *s, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (size_t i = 0; i < len; ++i)
+    h = (h ^ (unsigned char) s[i]) * 0x100000001b3ULL;
+  return (uint32_t) (h ^ (h >> 32));
+}
+
+/*
+ * Returns the id of a string, or CINTERN_NONE after storing the empty slot
+ * where it would go in *slot. The table must have slots.
+ */
+static inline uint32_t
+__cintern_probe(const cintern_t *t, const char *s, size_t len, uint32_t h,
+                size_t *slot)
+{
+  size_t mask = t->__cap - 1;
+
+  for (size_t i = h & mask;; i = (i + 1) & mask)
+  {
+    uint32_t e = t->__slots[i];
+
+    if (!e)
+    {
+      *slot = i;
+      return CINTERN_NONE;
+    }
+    if (t->__hashes.__data[e - 1] == h &&
+        cstrvec_len(t->__strs, e - 1) == len &&
+        memcmp(cstrvec_get(t->__strs, e - 1), s, len) == 0)
+      return e - 1;
+  }
+}
+
+static inline int
+__cintern_rehash(cintern_t *t, size_t cap)
+{
+  uint32_t *slots = calloc(cap, sizeof(uint32_t));
+
+  if (!slots)
+    return 0;
+  for (uint32_t id = 0; id < t->__hashes.__n; ++id)
+  {
+    size_t i = t->__hashes.__data[id] & (cap - 1);
+
+    while (slots[i])
+      i = (i + 1) & (cap - 1);
+    slots[i] = id + 1;
+  }
+  free(t->__slots);
+  t->__slots = slots;
+  t->__cap = cap;
+  return 1;
+}
+
+static inline uint32_t
+__cintern_find(const cintern_t *t, const char *s, size_t len, uint32_t h)
+{
+  size_t slot;
+
+  return t->__cap ? __cintern_probe(t, s, len, h, &slot) : CINTERN_NONE;
+}
+
+static inline uint32_t
+__cintern_id(cintern_t *t, const char *s, size_t len, uint32_t h)
+{
+  uint32_t id = __cintern_find(t, s, len, h);
+  size_t n = t->__hashes.__n;
+  size_t slot;
+
+  if (id != CINTERN_NONE)
+    return id;
+  if (n >= CINTERN_NONE - 1 ||
+      ((n + 1) * 2 > t->__cap &&
+       !__cintern_rehash(t, t->__cap ? t->__cap * 2 : 16)))
+  {
+    t->__e = CVEC_EOOM;
+    return CINTERN_NONE;
+  }
+  __cintern_probe(t, s, len, h, &slot);
+  cstrvec_push(t->__strs, s, len);
+  if (cstrvec_size(t->__strs) == n)
+  {
+    t->__e = CVEC_EOOM;
+    return CINTERN_NONE;
+  }
+  cvec_push_back(t->__hashes, h);
+  if (t->__hashes.__n == n)
+  {
+    cstrvec_pop_back(t->__strs);
+    t->__e = CVEC_EOOM;
+    return CINTERN_NONE;
+  }
+  t->__slots[slot] = (uint32_t) n + 1;
+  return (uint32_t) n;
+}
+
+static inline uint32_t
+__cintern_id_str(cintern_t *t, const char *s)
+{
+  size_t len = strlen(s);
+
+  return __cintern_id(t, s, len, __cintern_hash(s, len));
+}
+
+/*
+ * cintern_free: Deallocates all the memory associated with this table.
+ *
+ * __t: The interning table.
+ */
+#define cintern_free(__t)                                                     \
+  do                                                                          \
+  {                                                                           \
+    cstrvec_free((__t).__strs);                                               \
+    cvec_free((__t).__hashes);                                                \
+    free((__t).__slots);                                                      \
+    (__t).__slots = NULL;                                                     \
+    (__t).__cap = 0;                                                          \
+    (__t).__e = CVEC_EOK;                                                     \
+  } while (0)
+
+/*
+ * cintern_id: Returns the id of a string, interning it if it is new.
+ *
+ * __t:   The interning table.
+ * __str: A pointer to the bytes of the string, which may point into a
+ *        string the table already holds.
+ * __len: The number of bytes.
+ *
+ * Returns CINTERN_NONE if the string is new and memory ran out.
+ */
+#define cintern_id(__t, __str, __len)                                         \
+  __cintern_id(&(__t), (__str), (__len), __cintern_hash((__str), (__len)))
+
+/*
+ * cintern_id_str: Returns the id of a NUL terminated string, interning it
+ * if it is new.
+ *
+ * __t:   The interning table.
+ * __str: The string, which may be one the table already holds.
+ */
+#define cintern_id_str(__t, __str) __cintern_id_str(&(__t), (__str))
+
+/*
+ * cintern_find: Returns the id of a string without interning it.
+ *
+ * __t:   The interning table.
+ * __str: A pointer to the bytes of the string.
+ * __len: The number of bytes.
+ *
+ * Returns CINTERN_NONE if the string has not been interned.
+ */
+#define cintern_find(__t, __str, __len)                                       \
+  __cintern_find(&(__t), (__str), (__len), __cintern_hash((__str), (__len)))
+
+/*
+ * cintern_str: Returns the string of an id, NUL terminated.
+ *
+ * __t:  The interning table.
+ * __id: An id returned by the table.
+ *
+ * The pointer stays valid until the next new string is interned.
+ */
+#define cintern_str(__t, __id) cstrvec_get((__t).__strs, (__id))
+
+/*
+ * cintern_len: Returns the length of the string of an id.
+ *
+ * __t:  The interning table.
+ * __id: An id returned by the table.
+ */
+#define cintern_len(__t, __id) cstrvec_len((__t).__strs, (__id))
+
+/*
+ * cintern_size: Returns the number of distinct strings, which is also one
+ * past the largest id.
+ *
+ * __t: The interning table.
+ */
+#define cintern_size(__t) cstrvec_size((__t).__strs)
+
+#ifdef __CVEC_HAS_ATOMICS
+/* A stripe of a cintern_sync_t, on cache lines of its own */
+struct __cintern_stripe
+{
+  cintern_t __t;
+  __cvec_atomic(int) __lock;
+  char __pad[CVEC_CACHE_LINE -
+             (sizeof(cintern_t) + sizeof(__cvec_atomic(int))) %
+                 CVEC_CACHE_LINE];
+};
+
+/*
+ * cintern_sync_t: The striped interning table type.
+ *
+ * The id of a string is its id within its stripe times the number of
+ * stripes, plus the number of the stripe, so ids are unique and stable but
+ * not dense.
+ */
+typedef struct
+{
+  struct __cintern_stripe *__stripes;
+  void *__mem;
+  size_t __nstripes;
+  __cvec_atomic(int) __e;
+} cintern_sync_t;
+
+static inline int
+__cintern_sync_init(cintern_sync_t *s, size_t nstripes)
+{
+  size_t m = 1;
+
+  while (m < nstripes)
+    m <<= 1;
+  s->__stripes = __cvec_sharded_alloc(&s->__mem, sizeof(*s->__stripes), m);
+  s->__nstripes = s->__stripes ? m : 0;
+  for (size_t i = 0; i < s->__nstripes; ++i)
+  {
+    cintern_t t = CINTERN_INIT;
+
+    s->__stripes[i].__t = t;
+  }
+  return s->__stripes ? CVEC_EOK : CVEC_EOOM;
+}
+
+static inline uint32_t
+__cintern_sync_id(cintern_sync_t *s, const char *str, size_t len, int add)
+{
+  uint32_t h = __cintern_hash(str, len);
+  size_t i = (size_t) (((uint64_t) h * s->__nstripes) >> 32);
+  struct __cintern_stripe *st = &s->__stripes[i];
+  int expected = 0;
+  uint32_t id;
+
+  while (!__cvec_cas(&st->__lock, &expected, 1, __CVEC_ACQUIRE))
+  {
+    expected = 0;
+    while (__cvec_load(&st->__lock, __CVEC_RELAXED))
+      ;
+  }
+  /* New strings need a local id that still maps to a 32-bit id */
+  if (add && st->__t.__hashes.__n <= (CINTERN_NONE - 1 - i) / s->__nstripes)
+    id = __cintern_id(&st->__t, str, len, h);
+  else
+    id = __cintern_find(&st->__t, str, len, h);
+  __cvec_store(&st->__lock, 0, __CVEC_RELEASE);
+  if (id == CINTERN_NONE)
+  {
+    if (add)
+      __cvec_store(&s->__e, CVEC_EOOM, __CVEC_RELAXED);
+    return id;
+  }
+  return (uint32_t) (id * s->__nstripes + i);
+}
+
+static inline void
+__cintern_sync_free(cintern_sync_t *s)
+{
+  for (size_t i = 0; i < s->__nstripes; ++i)
+    cintern_free(s->__stripes[i].__t);
+  free(s->__mem);
+  s->__mem = NULL;
+  s->__stripes = NULL;
+  s->__nstripes = 0;
+}
+
+/*
+ * cintern_sync_init: Initializes an empty striped interning table.
+ *
+ * __s:     The table to initialize.
+ * __count: The number of stripes, rounded up to a power of two. A few per
+ *          thread keeps contention low.
+ */
+#define cintern_sync_init(__s, __count)                                       \
+  __cvec_store(&(__s).__e, __cintern_sync_init(&(__s), (__count)),            \
+               __CVEC_RELAXED)
+
+/*
+ * cintern_sync_free: Deallocates all the memory associated with this table.
+ *
+ * __s: The table, which no thread may use afterwards.
+ */
+#define cintern_sync_free(__s) __cintern_sync_free(&(__s))
+
+/*
+ * cintern_sync_id: Returns the id of a string, interning it if it is new.
+ *
+ * __s:   The table. Any thread may call this.
+ * __str: A pointer to the bytes of the string.
+ * __len: The number of bytes.
+ *
+ * Returns CINTERN_NONE if the string is new and memory ran out.
+ */
+#define cintern_sync_id(__s, __str, __len)                                    \
+  __cintern_sync_id(&(__s), (__str), (__len), 1)
+
+/*
+ * cintern_sync_find: Returns the id of a string without interning it.
+ *
+ * __s:   The table. Any thread may call this.
+ * __str: A pointer to the bytes of the string.
+ * __len: The number of bytes.
+ *
+ * Returns CINTERN_NONE if the string has not been interned.
+ */
+#define cintern_sync_find(__s, __str, __len)                                  \
+  __cintern_sync_id(&(__s), (__str), (__len), 0)
+
+/*
+ * cintern_sync_str: Returns the string of an id, NUL terminated.
+ *
+ * __s:  The table.
+ * __id: An id returned by the table.
+ *
+ * This does not lock, so call it only once no thread is interning.
+ */
+#define cintern_sync_str(__s, __id)                                           \
+  cintern_str((__s).__stripes[(__id) & ((__s).__nstripes - 1)].__t,           \
+              (__id) / (__s).__nstripes)
+
+/*
+ * cintern_sync_len: Returns the length of the string of an id.
+ *
+ * __s:  The table.
+ * __id: An id returned by the table.
+ *
+ * This does not lock, so call it only once no thread is interning.
+ */
+#define cintern_sync_len(__s, __id)                                           \
+  cintern_len((__s).__stripes[(__id) & ((__s).__nstripes - 1)].__t,           \
+              (__id) / (__s).__nstripes)
+#endif /* __CVEC_HAS_ATOMICS */
+
+#endif /* __CINTERN_H__ */
@@ -0,0 +1,600 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A hash map with open addressing, stored in flat arrays like a cvec_t.
+ *
+ * Each slot has a control byte that is either empty or holds 7 bits of the
+ * hash of its key, and lookups compare 16 control bytes at a time before
+ * touching any keys. Collisions are resolved by linear probing, and erasing
+ * shifts later entries back instead of leaving tombstones, so lookups never
+ * slow down after many erases.
+ *
+ * Keys are passed by address, the same way bsearch takes them, so that the
+ * hash and equality functions can work on any key type:
+ *
+ *    cmap_t(uint64_t, int) m =
+ *        CMAP_INIT(uint64_t, int, -1, cmap_hash_u64, cmap_eq_u64, NULL);
+ *    uint64_t k = 42;
+ *    cmap_put(m, &k, 7);
+ *    int v = cmap_get(m, &k);
+ *    ...
+ *    cmap_free(m);
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on maps too.
+ */
+
+#ifndef __CMAP_H__
+#define __CMAP_H__
+
+#include "cvec.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Control byte of an empty slot. Full slots hold a value below this. */
+#define __CMAP_EMPTY 0x80
+
+/* The number of control bytes compared at once */
+#define __CMAP_GROUP 16
+
+/*
+ * The untyped part of a map. Key and value arrays live in the typed
+ * struct, and the functions below address them through __ks and __vs.
+ * The control array has __CMAP_GROUP extra bytes at the end mirroring the
+ * first ones, so a group can be loaded at any slot without wrapping.
+ */
+struct __cmap_base
+{
+  unsigned char *__ctrl;
+  size_t __cap;
+  size_t __n;
+  size_t __ks;
+  size_t __vs;
+  size_t (*__hash)(const void *);
+  int (*__eq)(const void *, const void *);
+};
+
+/*
+ * cmap_t: Declare a new map type.
+ *
+ * __K: The type of keys.
+ * __V: The type of values.
+ */
+#define cmap_t(__K, __V)                                                      \
+  struct                                                                      \
+  {                                                                           \
+    struct __cmap_base __b;                                                   \
+    __K *__keys;                                                              \
+    __V *__vals;                                                              \
+    void (*__on_free)(__K, __V);                                              \
+    int __e;                                                                  \
+    __V __sentinel;                                                           \
+  }
+
+/*
+ * CMAP_INIT: Initializes all the fields of the map struct.
+ *
+ * __K:              The type of keys.
+ * __V:              The type of values.
+ * __sentinel_value: A value returned by cmap_get for missing keys.
+ * __hash:           A function returning the hash of a key, with the
+ *                   following signature:
+ *                       size_t <func>(const void *key);
+ * __eq:             A function returning non-zero if two keys are equal,
+ *                   with the following signature:
+ *                       int <func>(const void *a, const void *b);
+ * __on_free:        A function to be called on each key and value of the
+ *                   map when they are destroyed.
+ */
+#define CMAP_INIT(__K, __V, __sentinel_value, __hash, __eq, __on_free)        \
+  {                                                                           \
+    {NULL, 0, 0, sizeof(__K), sizeof(__V), (__hash), (__eq)}, NULL, NULL,     \
+        (__on_free), CVEC_EOK, (__sentinel_value)                             \
+  }
+
+/*
+ * cmap_init: Initializes all the fields of the map struct.
+ *
+ * __m:              The map to initialize.
+ * __K:              The type of keys.
+ * __V:              The type of values.
+ * __sentinel_value: A value returned by cmap_get for missing keys.
+ * __hash_fn:        A function returning the hash of a key.
+ * __eq_fn:          A function returning non-zero if two keys are equal.
+ * __free_fn:        A function to be called on each key and value of the
+ *                   map when they are destroyed.
+ */
+#define cmap_init(__m, __K, __V, __sentinel_value, __hash_fn, __eq_fn,        \
+                  __free_fn)                                                  \
+  do                                                                          \
+  {                                                                           \
+    (__m).__b.__ctrl = NULL;                                                  \
+    (__m).__b.__cap = 0;                                                      \
+    (__m).__b.__n = 0;                                                        \
+    (__m).__b.__ks = sizeof(__K);                                             \
+    (__m).__b.__vs = sizeof(__V);                                             \
+    (__m).__b.__hash = (__hash_fn);                                           \
+    (__m).__b.__eq = (__eq_fn);                                               \
+    (__m).__keys = NULL;                                                      \
+    (__m).__vals = NULL;                                                      \
+    (__m).__on_free = (__free_fn);                                            \
+    (__m).__e = CVEC_EOK;                                                     \
+    (__m).__sentinel = (__sentinel_value);                                    \
+  } while (0)
+
+/* Hash and equality functions for common key types */
+static inline size_t
+cmap_hash_u32(const void *key)
+{
+  return *(const uint32_t *) key;
+}
+
+static inline int
+cmap_eq_u32(const void *a, const void *b)
+{
+  return *(const uint32_t *) a == *(const uint32_t *) b;
+}
+
+static inline size_t
+cmap_hash_u64(const void *key)
+{
+  return (size_t) *(const uint64_t *) key;
+}
+
+static inline int
+cmap_eq_u64(const void *a, const void *b)
+{
+  return *(const uint64_t *) a == *(const uint64_t *) b;
+}
+
+/* For keys of type char * (or const char *) holding NUL terminated strings */
+static inline size_t
+cmap_hash_str(const void *key)
+{
+  const char *s = *(const char *const *) key;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  while (*s)
+    h = (h ^ (unsigned char) *s++) * 0x100000001b3ULL;
+  return (size_t) h;
+}
+
+static inline int
+cmap_eq_str(const void *a, const void *b)
+{
+  return strcmp(*(const char *const *) a, *(const char *const *) b) == 0;
+}
+
+/*
+ * User hashes may be as weak as the identity function, so spread them
+ * before taking the home slot from the high bits and the control byte from
+ * the low 7 bits.
+ */
+static inline uint64_t
+__cmap_mix(size_t h)
+{
+  uint64_t x = (uint64_t) h * 0x9e3779b97f4a7c15ULL;
+  return x ^ (x >> 29);
+}
+
+/*
+ * Returns one bit per control byte in the group at ctrl that equals h2,
+ * and stores one bit per empty control byte in *empty.
+ */
+static inline unsigned
+__cmap_match(const unsigned char *ctrl, unsigned char h2, unsigned *empty)
+{
+#ifdef __SSE2__
+  __m128i g = _mm_loadu_si128((const __m128i *) ctrl);
+  *empty = (unsigned) _mm_movemask_epi8(g);
+  return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+#else
+  unsigned m = 0, e = 0;
+  for (unsigned i = 0; i < __CMAP_GROUP; ++i)
+  {
+    m |= (unsigned) (ctrl[i] == h2) << i;
+    e |= (unsigned) (ctrl[i] == __CMAP_EMPTY) << i;
+  }
+  *empty = e;
+  return m;
+#endif
+}
+
+static inline void
+__cmap_set_ctrl(struct __cmap_base *b, size_t i, unsigned char c)
+{
+  b->__ctrl[i] = c;
+  if (i < __CMAP_GROUP)
+    b->__ctrl[b->__cap + i] = c;
+}
+
+/*
+ * Probes for key. Returns its slot if it is present. Otherwise returns
+ * CVEC_NPOS and, if ins is not null, stores the slot it would be inserted
+ * into in *ins.
+ */
+static inline size_t
+__cmap_probe(const struct __cmap_base *b, const unsigned char *keys,
+             const void *key, size_t *ins)
+{
+  uint64_t h = __cmap_mix(b->__hash(key));
+  unsigned char h2 = (unsigned char) (h & 0x7f);
+  size_t mask = b->__cap - 1;
+  size_t pos = (size_t) (h >> 7) & mask;
+  for (;;)
+  {
+    unsigned empty;
+    unsigned m = __cmap_match(b->__ctrl + pos, h2, &empty);
+    /* Linear probing keeps a key in the run before the first empty slot */
+    if (empty)
+      m &= (empty & -empty) - 1;
+    for (; m; m &= m - 1)
+    {
+      size_t i = (pos + (size_t) __cvec_ctz(m)) & mask;
+      if (b->__eq(keys + i * b->__ks, key))
+        return i;
+    }
+    if (empty)
+    {
+      if (ins)
+        *ins = (pos + (size_t) __cvec_ctz(empty)) & mask;
+      return CVEC_NPOS;
+    }
+    pos = (pos + __CMAP_GROUP) & mask;
+  }
+}
+
+static inline size_t
+__cmap_find(const struct __cmap_base *b, const void *keys, const void *key)
+{
+  if (b->__n == 0)
+    return CVEC_NPOS;
+  return __cmap_probe(b, (const unsigned char *) keys, key, NULL);
+}
+
+/* Like __cmap_find, but returns the sentinel slot for missing keys */
+static inline size_t
+__cmap_slot(const struct __cmap_base *b, const void *keys, const void *key)
+{
+  size_t i = __cmap_find(b, keys, key);
+  return i == CVEC_NPOS ? b->__cap : i;
+}
+
+static inline void *
+__cmap_lookup(const struct __cmap_base *b, const void *keys, void *vals,
+              const void *key)
+{
+  size_t i = __cmap_find(b, keys, key);
+  return i == CVEC_NPOS ? NULL : (unsigned char *) vals + i * b->__vs;
+}
+
+/*
+ * Moves every entry into new arrays with room for cap slots, which must be
+ * a power of two no smaller than __CMAP_GROUP. The value array gets one
+ * more slot past the end, which the typed macros fill with the sentinel so
+ * that cmap_get needs a single lookup. Returns CVEC_EOK or CVEC_EOOM, in
+ * which case the map is left unchanged.
+ */
+static inline int
+__cmap_rehash(struct __cmap_base *b, void **keys, void **vals, size_t cap)
+{
+  unsigned char *ctrl = malloc(cap + __CMAP_GROUP);
+  unsigned char *nk = malloc(cap * b->__ks);
+  unsigned char *nv = malloc((cap + 1) * b->__vs);
+  const unsigned char *ok = *keys;
+  const unsigned char *ov = *vals;
+  struct __cmap_base nb = *b;
+  if (!ctrl || !nk || !nv)
+  {
+    free(ctrl);
+    free(nk);
+    free(nv);
+    return CVEC_EOOM;
+  }
+  memset(ctrl, __CMAP_EMPTY, cap + __CMAP_GROUP);
+  nb.__ctrl = ctrl;
+  nb.__cap = cap;
+  for (size_t i = 0; i < b->__cap; ++i)
+  {
+    size_t j = 0;
+    if (b->__ctrl[i] == __CMAP_EMPTY)
+      continue;
+    __cmap_probe(&nb, nk, ok + i * b->__ks, &j);
+    __cmap_set_ctrl(&nb, j, b->__ctrl[i]);
+    memcpy(nk + j * b->__ks, ok + i * b->__ks, b->__ks);
+    memcpy(nv + j * b->__vs, ov + i * b->__vs, b->__vs);
+  }
+  free(b->__ctrl);
+  free(*keys);
+  free(*vals);
+  *b = nb;
+  *keys = nk;
+  *vals = nv;
+  return CVEC_EOK;
+}
+
+/* Grows the map so that n entries stay under a 7/8 load factor */
+static inline int
+__cmap_reserve(struct __cmap_base *b, void **keys, void **vals, size_t n)
+{
+  size_t cap = b->__cap ? b->__cap : __CMAP_GROUP;
+  while (n > cap - cap / 8)
+    cap <<= 1;
+  if (cap == b->__cap)
+    return CVEC_EOK;
+  return __cmap_rehash(b, keys, vals, cap);
+}
+
+/*
+ * Returns the slot for key, claiming an empty one if it is not present yet,
+ * in which case *added is set. The map must have room for one more entry.
+ */
+static inline size_t
+__cmap_claim(struct __cmap_base *b, const void *keys, const void *key,
+             int *added)
+{
+  size_t j = 0;
+  size_t i = __cmap_probe(b, (const unsigned char *) keys, key, &j);
+  *added = i == CVEC_NPOS;
+  if (*added)
+  {
+    uint64_t h = __cmap_mix(b->__hash(key));
+    __cmap_set_ctrl(b, j, (unsigned char) (h & 0x7f));
+    ++b->__n;
+    i = j;
+  }
+  return i;
+}
+
+/*
+ * Empties slot i and shifts back the entries after it whose home slot is
+ * not between it and their own slot, so that no probe run is broken.
+ */
+static inline void
+__cmap_remove(struct __cmap_base *b, void *keys, void *vals, size_t i)
+{
+  unsigned char *k = keys;
+  unsigned char *v = vals;
+  size_t mask = b->__cap - 1;
+  for (size_t j = (i + 1) & mask; b->__ctrl[j] != __CMAP_EMPTY;
+       j = (j + 1) & mask)
+  {
+    uint64_t h = __cmap_mix(b->__hash(k + j * b->__ks));
+    size_t home = (size_t) (h >> 7) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask))
+    {
+      memcpy(k + i * b->__ks, k + j * b->__ks, b->__ks);
+      memcpy(v + i * b->__vs, v + j * b->__vs, b->__vs);
+      __cmap_set_ctrl(b, i, b->__ctrl[j]);
+      i = j;
+    }
+  }
+  __cmap_set_ctrl(b, i, __CMAP_EMPTY);
+  --b->__n;
+}
+
+/*
+ * cmap_free: Deallocates all the memory associated with this map.
+ *
+ * __m: The map.
+ *
+ * If __on_free is not null, then it is called on each key and value in the
+ * map.
+ */
+#define cmap_free(__m)                                                        \
+  do                                                                          \
+  {                                                                           \
+    if ((__m).__on_free)                                                      \
+      for (size_t __i = 0; __i < (__m).__b.__cap; ++__i)                      \
+        if ((__m).__b.__ctrl[__i] != __CMAP_EMPTY)                            \
+          (__m).__on_free((__m).__keys[__i], (__m).__vals[__i]);              \
+    free((__m).__b.__ctrl);                                                   \
+    free((__m).__keys);                                                       \
+    free((__m).__vals);                                                       \
+    (__m).__b.__ctrl = NULL;                                                  \
+    (__m).__keys = NULL;                                                      \
+    (__m).__vals = NULL;                                                      \
+    (__m).__b.__cap = 0;                                                      \
+    (__m).__b.__n = 0;                                                        \
+    (__m).__e = CVEC_EOK;                                                     \
+  } while (0)
+
+/*
+ * cmap_clear: Remove every entry from a map.
+ *
+ * __m: The map.
+ *
+ * If __on_free is not null, then it is called on each key and value
+ * currently in the map. Also note that the capacity of the map is left
+ * unchanged.
+ */
+#define cmap_clear(__m)                                                       \
+  do                                                                          \
+  {                                                                           \
+    if ((__m).__b.__n == 0)                                                   \
+      break;                                                                  \
+    if ((__m).__on_free)                                                      \
+      for (size_t __i = 0; __i < (__m).__b.__cap; ++__i)                      \
+        if ((__m).__b.__ctrl[__i] != __CMAP_EMPTY)                            \
+          (__m).__on_free((__m).__keys[__i], (__m).__vals[__i]);              \
+    memset((__m).__b.__ctrl, __CMAP_EMPTY, (__m).__b.__cap + __CMAP_GROUP);   \
+    (__m).__b.__n = 0;                                                        \
+  } while (0)
+
+/* A private macro that grows a map for __n entries and sets __ok */
+#define __cmap_grow(__m, __n, __ok)                                           \
+  do                                                                          \
+  {                                                                           \
+    void *__rk = (__m).__keys;                                                \
+    void *__rv = (__m).__vals;                                                \
+    (__ok) = __cmap_reserve(&(__m).__b, &__rk, &__rv, (__n)) == CVEC_EOK;     \
+    if (!(__ok))                                                              \
+    {                                                                         \
+      (__m).__e = CVEC_EOOM;                                                  \
+      break;                                                                  \
+    }                                                                         \
+    (__m).__keys = __rk;                                                      \
+    (__m).__vals = __rv;                                                      \
+    (__m).__vals[(__m).__b.__cap] = (__m).__sentinel;                         \
+  } while (0)
+
+/*
+ * cmap_reserve: Reserve memory ahead of time.
+ *
+ * __m: The map.
+ * __n: The number of entries to make room for.
+ */
+#define cmap_reserve(__m, __n)                                                \
+  do                                                                          \
+  {                                                                           \
+    int __ok;                                                                 \
+    __cmap_grow(__m, __n, __ok);                                              \
+    (void) __ok;                                                              \
+  } while (0)
+
+/*
+ * cmap_put: Insert a key and value into a map, or replace the value of a
+ *           key that is already present.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ * __val: The value.
+ *
+ * When a key is replaced, __on_free is called on the old key and value if
+ * it is not null.
+ */
+#define cmap_put(__m, __key, __val)                                           \
+  do                                                                          \
+  {                                                                           \
+    int __added;                                                              \
+    int __ok;                                                                 \
+    size_t __s;                                                               \
+    __cmap_grow(__m, (__m).__b.__n + 1, __ok);                                \
+    if (!__ok)                                                                \
+      break;                                                                  \
+    __s = __cmap_claim(&(__m).__b, (__m).__keys, (__key), &__added);          \
+    if (!__added && (__m).__on_free)                                          \
+      (__m).__on_free((__m).__keys[__s], (__m).__vals[__s]);                  \
+    (__m).__keys[__s] = *(__key);                                             \
+    (__m).__vals[__s] = (__val);                                              \
+  } while (0)
+
+/*
+ * cmap_find: Returns a pointer to the value of a key in a map.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ *
+ * If the key is not present, this will return NULL. The result is a void
+ * pointer, as with bsearch, and stays valid until the map is next modified.
+ */
+#define cmap_find(__m, __key)                                                 \
+  __cmap_lookup(&(__m).__b, (__m).__keys, (__m).__vals, (__key))
+
+/*
+ * cmap_get: Returns the value of a key in a map.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ *
+ * If the key is not present, this will return the sentinel value provided
+ * during initialization.
+ */
+#define cmap_get(__m, __key)                                                  \
+  ((__m).__b.__cap                                                            \
+       ? (__m).__vals[__cmap_slot(&(__m).__b, (__m).__keys, (__key))]         \
+       : (__m).__sentinel)
+
+/*
+ * cmap_contains: Returns whether or not a key is present in a map.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ */
+#define cmap_contains(__m, __key)                                             \
+  (__cmap_find(&(__m).__b, (__m).__keys, (__key)) != CVEC_NPOS)
+
+/*
+ * cmap_erase: Remove a key and its value from a map.
+ *
+ * __m:   The map.
+ * __key: The address of the key.
+ *
+ * Nothing happens if the key is not present. If __on_free is not null, then
+ * it is called on the removed key and value.
+ */
+#define cmap_erase(__m, __key)                                                \
+  do                                                                          \
+  {                                                                           \
+    size_t __s = __cmap_find(&(__m).__b, (__m).__keys, (__key));              \
+    if (__s == CVEC_NPOS)                                                     \
+      break;                                                                  \
+    if ((__m).__on_free)                                                      \
+      (__m).__on_free((__m).__keys[__s], (__m).__vals[__s]);                  \
+    __cmap_remove(&(__m).__b, (__m).__keys, (__m).__vals, __s);               \
+  } while (0)
+
+/*
+ * cmap_foreach: Iterates over a map and performs an action on each entry.
+ *
+ * __m:        The map.
+ * __fun:      A callback function to be called on each entry with the
+ *             following signature:
+ *                 void <func>(__K key, __V val, void *userdata);
+ * __userdata: Any userdata to be passed along to the callback function.
+ *
+ * Entries are visited in no particular order.
+ */
+#define cmap_foreach(__m, __fun, __userdata)                                  \
+  do                                                                          \
+  {                                                                           \
+    for (size_t __i = 0; __i < (__m).__b.__cap; ++__i)                        \
+      if ((__m).__b.__ctrl[__i] != __CMAP_EMPTY)                              \
+        __fun((__m).__keys[__i], (__m).__vals[__i], (__userdata));            \
+  } while (0)
+
+/*
+ * cmap_size: Returns the total number of entries in the map.
+ *
+ * __m: The map.
+ */
+#define cmap_size(__m) (__m).__b.__n
+
+/*
+ * cmap_cap: Returns the number of slots in the map.
+ *
+ * __m: The map.
+ */
+#define cmap_cap(__m) (__m).__b.__cap
+
+/*
+ * cmap_empty: Returns whether or not the map is empty.
+ *
+ * __m: The map.
+ */
+#define cmap_empty(__m) ((__m).__b.__n == 0)
+
+#endif /* __CMAP_H__ */
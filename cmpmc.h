@@ -0,0 +1,312 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A bounded lock-free queue that any number of threads can push to and pop
+ * from.
+ *
+ * The ring is one allocation of cells, each holding an item and a sequence
+ * number that says whose turn it is: a producer may fill the cell for
+ * position p once its sequence is p, and a consumer may empty it once its
+ * sequence is p + 1. Emptying it sets the sequence to p plus the ring size,
+ * ready for the next lap. Producers and consumers each claim positions by
+ * advancing a shared counter, and those two counters sit on separate cache
+ * lines.
+ *
+ *    cmpmc_t(struct task) q;
+ *    cmpmc_init(q, struct task, 4096);
+ *
+ *    (any thread)                        (any thread)
+ *    struct task t = ...;                struct task u;
+ *    while (!cmpmc_try_push(q, t))       if (cmpmc_try_pop(q, u))
+ *      ;                                   run(&u);
+ *
+ * cmpmc_push_n and cmpmc_pop_n claim a whole run of cells with one
+ * compare-and-swap of the shared counter instead of one per item.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on queues too.
+ */
+
+#ifndef __CMPMC_H__
+#define __CMPMC_H__
+
+#include "cvec.h"
+
+#ifndef __CVEC_HAS_ATOMICS
+#error "cmpmc.h needs C11 atomics or the GCC/Clang __atomic builtins"
+#endif
+
+/*
+ * The untyped part of a queue. The cells themselves are typed, so the
+ * queue records their size and where the item sits within one. The struct
+ * need not start on a cache line, so a full line of padding around each
+ * counter keeps __tail and __head off each other's lines.
+ */
+struct __cmpmc_base
+{
+  char __pad0[CVEC_CACHE_LINE];
+  __cvec_atomic(size_t) __tail;
+  char __pad1[CVEC_CACHE_LINE];
+  __cvec_atomic(size_t) __head;
+  char __pad2[CVEC_CACHE_LINE];
+  size_t __mask;
+  size_t __t;
+  size_t __stride;
+  size_t __off;
+};
+
+/*
+ * The sequence number of the cell for position p.
+ */
+#define __cmpmc_seq(__b, __cells, __p)                                        \
+  ((__cvec_atomic(size_t) *) ((__cells) +                                     \
+                              ((__p) & (__b)->__mask) * (__b)->__stride))
+
+static inline void *
+__cmpmc_init(struct __cmpmc_base *b, size_t t, size_t stride, size_t cap)
+{
+  size_t m = 1;
+  char *cells;
+
+  while (m < cap)
+    m <<= 1;
+  memset(b, 0, sizeof(*b));
+  b->__mask = m - 1;
+  b->__t = t;
+  b->__stride = stride;
+  cells = malloc(m * stride);
+  if (cells)
+    for (size_t i = 0; i < m; ++i)
+      __cvec_store(__cmpmc_seq(b, cells, i), i, __CVEC_RELAXED);
+  return cells;
+}
+
+/*
+ * Claims up to n consecutive positions from *counter. A cell is ready when
+ * its sequence is the position plus lag: 0 for producers, 1 for consumers.
+ * Returns the number of positions claimed, the first of which goes in *pos.
+ */
+static inline size_t
+__cmpmc_claim(struct __cmpmc_base *b, char *cells,
+              __cvec_atomic(size_t) *counter, size_t lag, size_t n,
+              size_t *pos)
+{
+  size_t p = __cvec_load(counter, __CVEC_RELAXED);
+
+  for (;;)
+  {
+    size_t k = 0;
+
+    while (k < n &&
+           __cvec_load(__cmpmc_seq(b, cells, p + k), __CVEC_ACQUIRE) ==
+               p + k + lag)
+      ++k;
+    if (k)
+    {
+      if (__cvec_cas(counter, &p, p + k, __CVEC_RELAXED))
+      {
+        *pos = p;
+        return k;
+      }
+    }
+    else
+    {
+      size_t seq = __cvec_load(__cmpmc_seq(b, cells, p), __CVEC_ACQUIRE);
+
+      /* A cell still a lap behind means the queue is full, or empty */
+      if (!n || seq - (p + lag) > SIZE_MAX / 2)
+        return 0;
+      p = __cvec_load(counter, __CVEC_RELAXED);
+    }
+  }
+}
+
+/*
+ * The head is read first, so it cannot pass the tail that is read after
+ * it. The tail may still have moved on by more than the capacity since.
+ */
+static inline size_t
+__cmpmc_size(struct __cmpmc_base *b)
+{
+  size_t head = __cvec_load(&b->__head, __CVEC_ACQUIRE);
+  size_t n = __cvec_load(&b->__tail, __CVEC_ACQUIRE) - head;
+
+  if (n > SIZE_MAX / 2)
+    return 0;
+  return n > b->__mask + 1 ? b->__mask + 1 : n;
+}
+
+static inline size_t
+__cmpmc_push_n(struct __cmpmc_base *b, void *cells, const void *items,
+               size_t n)
+{
+  size_t pos;
+
+  n = __cmpmc_claim(b, cells, &b->__tail, 0, n, &pos);
+  for (size_t i = 0; i < n; ++i)
+  {
+    char *cell = (char *) cells + ((pos + i) & b->__mask) * b->__stride;
+
+    memcpy(cell + b->__off, (const char *) items + i * b->__t, b->__t);
+    __cvec_store((__cvec_atomic(size_t) *) cell, pos + i + 1,
+                 __CVEC_RELEASE);
+  }
+  return n;
+}
+
+static inline size_t
+__cmpmc_pop_n(struct __cmpmc_base *b, void *cells, void *items, size_t n)
+{
+  size_t pos;
+
+  n = __cmpmc_claim(b, cells, &b->__head, 1, n, &pos);
+  for (size_t i = 0; i < n; ++i)
+  {
+    char *cell = (char *) cells + ((pos + i) & b->__mask) * b->__stride;
+
+    memcpy((char *) items + i * b->__t, cell + b->__off, b->__t);
+    __cvec_store((__cvec_atomic(size_t) *) cell, pos + i + b->__mask + 1,
+                 __CVEC_RELEASE);
+  }
+  return n;
+}
+
+/*
+ * cmpmc_t: Declare a new queue type.
+ *
+ * __T: The type of items that the queue holds.
+ */
+#define cmpmc_t(__T)                                                          \
+  struct                                                                      \
+  {                                                                           \
+    struct __cmpmc_base __b;                                                  \
+    struct                                                                    \
+    {                                                                         \
+      __cvec_atomic(size_t) __seq;                                            \
+      __T __item;                                                             \
+    } *__cells;                                                               \
+    int __e;                                                                  \
+  }
+
+/*
+ * cmpmc_init: Initializes an empty queue.
+ *
+ * __q:   The queue to initialize.
+ * __T:   The type of items that the queue holds.
+ * __cap: The number of items the queue can hold. This is rounded up to a
+ *        power of two.
+ */
+#define cmpmc_init(__q, __T, __cap)                                           \
+  do                                                                          \
+  {                                                                           \
+    (__q).__cells = __cmpmc_init(&(__q).__b, sizeof(__T),                     \
+                                 sizeof(*(__q).__cells), (__cap));            \
+    (__q).__e = (__q).__cells ? CVEC_EOK : CVEC_EOOM;                         \
+    if ((__q).__cells)                                                        \
+      (__q).__b.__off = (size_t) ((char *) &(__q).__cells->__item -           \
+                                  (char *) (__q).__cells);                    \
+  } while (0)
+
+/*
+ * cmpmc_free: Deallocates the cells of a queue.
+ *
+ * __q: The queue, which no thread may use afterwards.
+ */
+#define cmpmc_free(__q)                                                       \
+  do                                                                          \
+  {                                                                           \
+    free((__q).__cells);                                                      \
+    (__q).__cells = NULL;                                                     \
+  } while (0)
+
+/*
+ * cmpmc_push_n: Add up to a number of items at the tail of the queue.
+ *
+ * __q:     The queue.
+ * __items: A pointer to the items to add, of the type the queue holds.
+ * __n:     The number of items at __items.
+ *
+ * Returns the number of items added, which is less than __n if the queue
+ * fills up. The items that were added are consecutive in the queue.
+ */
+#define cmpmc_push_n(__q, __items, __n)                                       \
+  (__cvec_check_item((__items), &(__q).__cells->__item),                      \
+   __cmpmc_push_n(&(__q).__b, (__q).__cells, (__items), (__n)))
+
+/*
+ * cmpmc_pop_n: Remove up to a number of items from the head of the queue.
+ *
+ * __q:     The queue.
+ * __items: A pointer to room for __n items of the type the queue holds.
+ * __n:     The most items to remove.
+ *
+ * Returns the number of items removed.
+ */
+#define cmpmc_pop_n(__q, __items, __n)                                        \
+  (__cvec_check_item((__items), &(__q).__cells->__item),                      \
+   __cmpmc_pop_n(&(__q).__b, (__q).__cells, (__items), (__n)))
+
+/*
+ * cmpmc_try_push: Add an item at the tail of the queue.
+ *
+ * __q:    The queue.
+ * __item: An lvalue of the type the queue holds, holding the item to add.
+ *
+ * Returns non-zero if the item was added, or zero if the queue is full.
+ */
+#define cmpmc_try_push(__q, __item) cmpmc_push_n((__q), &(__item), 1)
+
+/*
+ * cmpmc_try_pop: Remove the item at the head of the queue.
+ *
+ * __q:    The queue.
+ * __item: An lvalue of the type the queue holds, to store the removed item
+ *         in.
+ *
+ * Returns non-zero if an item was removed, or zero if the queue is empty.
+ */
+#define cmpmc_try_pop(__q, __item) cmpmc_pop_n((__q), &(__item), 1)
+
+/*
+ * cmpmc_size: Returns the number of items in the queue.
+ *
+ * __q: The queue.
+ *
+ * When other threads are active this is only a snapshot, and it counts
+ * items that are claimed but not yet written or read. It is never more
+ * than cmpmc_cap.
+ */
+#define cmpmc_size(__q) __cmpmc_size(&(__q).__b)
+
+/*
+ * cmpmc_cap: Returns the number of items the queue can hold.
+ *
+ * __q: The queue.
+ */
+#define cmpmc_cap(__q) ((__q).__b.__mask + 1)
+
+#undef __cmpmc_seq
+
+#endif /* __CMPMC_H__ */
@@ -0,0 +1,478 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A slot map: values stored densely like a cvec_t and referred to by
+ * handles that stay valid until their value is erased.
+ *
+ * A handle holds a 32-bit slot index and the 32-bit generation of that
+ * slot. Each slot gives the position of its value in the dense array, and
+ * each position records which slot owns it, so erasing moves the last value
+ * into the gap and fixes up that value's slot. Erasing also bumps the
+ * generation of the freed slot and puts it on a free list for reuse, which
+ * makes handles to the erased value fail every later lookup. Insert, erase
+ * and lookup are all O(1), and the values stay packed for iteration:
+ *
+ *    cslotmap_t(struct conn) conns;
+ *    cslotmap_init(conns, struct conn, no_conn, NULL);
+ *    cslotmap_handle_t h;
+ *    cslotmap_insert(conns, c, h);
+ *    struct conn *p = cslotmap_find(conns, h);
+ *    ...
+ *    cslotmap_erase(conns, h);
+ *    // cslotmap_find(conns, h) now returns NULL
+ *    ...
+ *    cslotmap_free(conns);
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on slot maps too.
+ */
+
+#ifndef __CSLOTMAP_H__
+#define __CSLOTMAP_H__
+
+#include "cvec.h"
+
+/*
+ * A handle to a value in a slot map: the generation in the high 32 bits and
+ * the slot index in the low 32 bits. Generations of live slots are odd, so
+ * CSLOTMAP_NULL never refers to a value.
+ */
+typedef uint64_t cslotmap_handle_t;
+
+#define CSLOTMAP_NULL ((cslotmap_handle_t) 0)
+
+/* Marks the end of the free list */
+#define __CSLOTMAP_NONE UINT32_MAX
+
+/*
+ * A slot. __pos is the position of its value while the slot is live, and
+ * the next slot in the free list otherwise.
+ */
+struct __cslotmap_slot
+{
+  uint32_t __gen;
+  uint32_t __pos;
+};
+
+/*
+ * The untyped part of a slot map. The value array lives in the typed
+ * struct and has one more element than __cap, holding the sentinel at
+ * position __n so that cslotmap_get needs a single lookup.
+ */
+struct __cslotmap_base
+{
+  struct __cslotmap_slot *__slots;
+  uint32_t *__owner;
+  size_t __n;
+  size_t __cap;
+  size_t __nslots;
+  size_t __mslots;
+  uint32_t __free;
+  size_t __t;
+};
+
+static inline cslotmap_handle_t
+__cslotmap_handle(const struct __cslotmap_base *b, uint32_t slot)
+{
+  return (cslotmap_handle_t) b->__slots[slot].__gen << 32 | slot;
+}
+
+/* Returns the position of a handle's value, or CVEC_NPOS if it is stale */
+static inline size_t
+__cslotmap_find(const struct __cslotmap_base *b, cslotmap_handle_t h)
+{
+  uint32_t slot = (uint32_t) h;
+  uint32_t gen = (uint32_t) (h >> 32);
+
+  if (slot >= b->__nslots || b->__slots[slot].__gen != gen || !(gen & 1))
+    return CVEC_NPOS;
+  return b->__slots[slot].__pos;
+}
+
+/* Like __cslotmap_find, but returns the sentinel position for misses */
+static inline size_t
+__cslotmap_slot(const struct __cslotmap_base *b, cslotmap_handle_t h)
+{
+  size_t i = __cslotmap_find(b, h);
+  return i == CVEC_NPOS ? b->__n : i;
+}
+
+static inline void *
+__cslotmap_lookup(const struct __cslotmap_base *b, void *vals,
+                  cslotmap_handle_t h)
+{
+  size_t i = __cslotmap_find(b, h);
+  return i == CVEC_NPOS ? NULL : (unsigned char *) vals + i * b->__t;
+}
+
+/*
+ * Grows the value and owner arrays to hold cap values. Returns CVEC_EOK or
+ * CVEC_EOOM, in which case the map is left unchanged.
+ */
+static inline int
+__cslotmap_reserve(struct __cslotmap_base *b, void **vals, size_t cap)
+{
+  void *v;
+  uint32_t *o;
+
+  if (cap <= b->__cap)
+    return CVEC_EOK;
+  if (cap > __CSLOTMAP_NONE)
+    return CVEC_EOOM;
+  v = realloc(*vals, (cap + 1) * b->__t);
+  if (!v)
+    return CVEC_EOOM;
+  *vals = v;
+  o = realloc(b->__owner, cap * sizeof(*o));
+  if (!o)
+    return CVEC_EOOM;
+  b->__owner = o;
+  b->__cap = cap;
+  return CVEC_EOK;
+}
+
+/*
+ * Claims a slot for a new value at position __n and returns its handle, or
+ * CSLOTMAP_NULL if memory runs out. The caller stores the value.
+ */
+static inline cslotmap_handle_t
+__cslotmap_insert(struct __cslotmap_base *b, void **vals)
+{
+  uint32_t slot;
+
+  if (b->__n == b->__cap &&
+      __cslotmap_reserve(b, vals, b->__cap ? 2 * b->__cap : 8) != CVEC_EOK &&
+      __cslotmap_reserve(b, vals, b->__n + 1) != CVEC_EOK)
+    return CSLOTMAP_NULL;
+  if (b->__free != __CSLOTMAP_NONE)
+  {
+    slot = b->__free;
+    b->__free = b->__slots[slot].__pos;
+  }
+  else
+  {
+    if (b->__nslots == b->__mslots)
+    {
+      size_t m = b->__mslots ? 2 * b->__mslots : 8;
+      struct __cslotmap_slot *s;
+
+      if (m > __CSLOTMAP_NONE)
+        m = __CSLOTMAP_NONE;
+      if (m == b->__nslots || !(s = realloc(b->__slots, m * sizeof(*s))))
+        return CSLOTMAP_NULL;
+      b->__slots = s;
+      b->__mslots = m;
+    }
+    slot = (uint32_t) b->__nslots++;
+    b->__slots[slot].__gen = 0;
+  }
+  b->__slots[slot].__gen++;
+  b->__slots[slot].__pos = (uint32_t) b->__n;
+  b->__owner[b->__n++] = slot;
+  return __cslotmap_handle(b, slot);
+}
+
+/*
+ * Bumps the generation of a slot and puts it on the free list. A slot
+ * whose generation would wrap around is retired instead, so that no old
+ * handle can ever match it again.
+ */
+static inline void
+__cslotmap_release(struct __cslotmap_base *b, uint32_t slot)
+{
+  if (++b->__slots[slot].__gen == UINT32_MAX - 1)
+    return;
+  b->__slots[slot].__pos = b->__free;
+  b->__free = slot;
+}
+
+/* Removes the value at position i by moving the last value into its place */
+static inline void
+__cslotmap_remove(struct __cslotmap_base *b, void *vals, size_t i)
+{
+  size_t last = --b->__n;
+
+  __cslotmap_release(b, b->__owner[i]);
+  if (i != last)
+  {
+    memcpy((unsigned char *) vals + i * b->__t,
+           (unsigned char *) vals + last * b->__t, b->__t);
+    b->__owner[i] = b->__owner[last];
+    b->__slots[b->__owner[i]].__pos = (uint32_t) i;
+  }
+}
+
+static inline void
+__cslotmap_clear(struct __cslotmap_base *b)
+{
+  for (size_t i = 0; i < b->__n; ++i)
+    __cslotmap_release(b, b->__owner[i]);
+  b->__n = 0;
+}
+
+/*
+ * cslotmap_t: Declare a new slot map type.
+ *
+ * __T: The type of values.
+ */
+#define cslotmap_t(__T)                                                       \
+  struct                                                                      \
+  {                                                                           \
+    struct __cslotmap_base __b;                                               \
+    __T *__vals;                                                              \
+    void (*__on_free)(__T);                                                   \
+    int __e;                                                                  \
+    __T __sentinel;                                                           \
+  }
+
+/*
+ * CSLOTMAP_INIT: Initializes all the fields of the slot map struct.
+ *
+ * __T:              The type of values.
+ * __sentinel_value: A value returned by cslotmap_get for stale handles.
+ * __on_free:        A function to be called on each value of the map when
+ *                   it is destroyed.
+ */
+#define CSLOTMAP_INIT(__T, __sentinel_value, __on_free)                       \
+  {                                                                           \
+    {NULL, NULL, 0, 0, 0, 0, __CSLOTMAP_NONE, sizeof(__T)}, NULL,             \
+        (__on_free), CVEC_EOK, (__sentinel_value)                             \
+  }
+
+/*
+ * cslotmap_init: Initializes all the fields of the slot map struct.
+ *
+ * __s:              The slot map to initialize.
+ * __T:              The type of values.
+ * __sentinel_value: A value returned by cslotmap_get for stale handles.
+ * __free_fn:        A function to be called on each value of the map when
+ *                   it is destroyed.
+ */
+#define cslotmap_init(__s, __T, __sentinel_value, __free_fn)                  \
+  do                                                                          \
+  {                                                                           \
+    memset(&(__s).__b, 0, sizeof((__s).__b));                                 \
+    (__s).__b.__free = __CSLOTMAP_NONE;                                       \
+    (__s).__b.__t = sizeof(__T);                                              \
+    (__s).__vals = NULL;                                                      \
+    (__s).__on_free = (__free_fn);                                            \
+    (__s).__e = CVEC_EOK;                                                     \
+    (__s).__sentinel = (__sentinel_value);                                    \
+  } while (0)
+
+/*
+ * cslotmap_free: Deallocates all the memory associated with a slot map.
+ *
+ * __s: The slot map.
+ *
+ * If __on_free is not null, then it is called on each value in the map.
+ */
+#define cslotmap_free(__s)                                                    \
+  do                                                                          \
+  {                                                                           \
+    if ((__s).__on_free)                                                      \
+      for (size_t __i = 0; __i < (__s).__b.__n; ++__i)                        \
+        (__s).__on_free((__s).__vals[__i]);                                   \
+    free((__s).__b.__slots);                                                  \
+    free((__s).__b.__owner);                                                  \
+    free((__s).__vals);                                                       \
+    (__s).__b.__slots = NULL;                                                 \
+    (__s).__b.__owner = NULL;                                                 \
+    (__s).__b.__n = 0;                                                        \
+    (__s).__b.__cap = 0;                                                      \
+    (__s).__b.__nslots = 0;                                                   \
+    (__s).__b.__mslots = 0;                                                   \
+    (__s).__b.__free = __CSLOTMAP_NONE;                                       \
+    (__s).__vals = NULL;                                                      \
+    (__s).__e = CVEC_EOK;                                                     \
+  } while (0)
+
+/*
+ * cslotmap_clear: Remove every value from a slot map. All handles become
+ * stale, but the slots and the capacity are kept.
+ *
+ * __s: The slot map.
+ *
+ * If __on_free is not null, then it is called on each value in the map.
+ */
+#define cslotmap_clear(__s)                                                   \
+  do                                                                          \
+  {                                                                           \
+    if ((__s).__on_free)                                                      \
+      for (size_t __i = 0; __i < (__s).__b.__n; ++__i)                        \
+        (__s).__on_free((__s).__vals[__i]);                                   \
+    __cslotmap_clear(&(__s).__b);                                             \
+    if ((__s).__vals)                                                         \
+      (__s).__vals[0] = (__s).__sentinel;                                     \
+  } while (0)
+
+/*
+ * cslotmap_reserve: Reserve room for values ahead of time.
+ *
+ * __s:     The slot map.
+ * __count: The number of values to make room for.
+ */
+#define cslotmap_reserve(__s, __count)                                        \
+  do                                                                          \
+  {                                                                           \
+    void *__sv = (__s).__vals;                                                \
+    if (__cslotmap_reserve(&(__s).__b, &__sv, (__count)) != CVEC_EOK)         \
+      (__s).__e = CVEC_EOOM;                                                  \
+    (__s).__vals = __sv;                                                      \
+    if ((__s).__vals)                                                         \
+      (__s).__vals[(__s).__b.__n] = (__s).__sentinel;                         \
+  } while (0)
+
+/*
+ * cslotmap_insert: Add a value to a slot map.
+ *
+ * __s:      The slot map.
+ * __item:   The value to add.
+ * __handle: A cslotmap_handle_t lvalue that receives the handle of the new
+ *           value, or CSLOTMAP_NULL if memory ran out.
+ */
+#define cslotmap_insert(__s, __item, __handle)                                \
+  do                                                                          \
+  {                                                                           \
+    void *__sv = (__s).__vals;                                                \
+    (__handle) = __cslotmap_insert(&(__s).__b, &__sv);                        \
+    (__s).__vals = __sv;                                                      \
+    if ((__handle) == CSLOTMAP_NULL)                                          \
+    {                                                                         \
+      (__s).__e = CVEC_EOOM;                                                  \
+      break;                                                                  \
+    }                                                                         \
+    (__s).__vals[(__s).__b.__n - 1] = (__item);                               \
+    (__s).__vals[(__s).__b.__n] = (__s).__sentinel;                           \
+  } while (0)
+
+/*
+ * cslotmap_erase: Remove the value of a handle from a slot map.
+ *
+ * __s:      The slot map.
+ * __handle: The handle. Nothing happens if it is stale.
+ *
+ * The last value in the dense array takes the place of the erased one. If
+ * __on_free is not null, then it is called on the erased value.
+ */
+#define cslotmap_erase(__s, __handle)                                         \
+  do                                                                          \
+  {                                                                           \
+    size_t __sp = __cslotmap_find(&(__s).__b, (__handle));                    \
+    if (__sp == CVEC_NPOS)                                                    \
+      break;                                                                  \
+    if ((__s).__on_free)                                                      \
+      (__s).__on_free((__s).__vals[__sp]);                                    \
+    __cslotmap_remove(&(__s).__b, (__s).__vals, __sp);                        \
+    (__s).__vals[(__s).__b.__n] = (__s).__sentinel;                           \
+  } while (0)
+
+/*
+ * cslotmap_find: Returns a pointer to the value of a handle.
+ *
+ * __s:      The slot map.
+ * __handle: The handle.
+ *
+ * If the handle is stale, this will return NULL. The result is a void
+ * pointer, as with cmap_find, and stays valid until the next insert or
+ * erase.
+ */
+#define cslotmap_find(__s, __handle)                                          \
+  __cslotmap_lookup(&(__s).__b, (__s).__vals, (__handle))
+
+/*
+ * cslotmap_get: Returns the value of a handle.
+ *
+ * __s:      The slot map.
+ * __handle: The handle.
+ *
+ * If the handle is stale, this will return the sentinel value provided
+ * during initialization.
+ */
+#define cslotmap_get(__s, __handle)                                           \
+  ((__s).__vals ? (__s).__vals[__cslotmap_slot(&(__s).__b, (__handle))]       \
+                : (__s).__sentinel)
+
+/*
+ * cslotmap_contains: Returns whether or not a handle refers to a value.
+ *
+ * __s:      The slot map.
+ * __handle: The handle.
+ */
+#define cslotmap_contains(__s, __handle)                                      \
+  (__cslotmap_find(&(__s).__b, (__handle)) != CVEC_NPOS)
+
+/*
+ * cslotmap_data: Returns the dense array of values, in no particular
+ * order. Values may be changed through it, but not added or removed.
+ *
+ * __s: The slot map.
+ */
+#define cslotmap_data(__s) ((__s).__vals)
+
+/*
+ * cslotmap_handle_at: Returns the handle of a value in the dense array.
+ *
+ * __s: The slot map.
+ * __i: The position of the value, below cslotmap_size.
+ */
+#define cslotmap_handle_at(__s, __i)                                          \
+  __cslotmap_handle(&(__s).__b, (__s).__b.__owner[(__i)])
+
+/*
+ * cslotmap_foreach: Iterates over a slot map and performs an action on
+ * each value.
+ *
+ * __s:        The slot map.
+ * __fun:      A callback function to be called on each value with the
+ *             following signature:
+ *                 void <func>(cslotmap_handle_t handle, __T val,
+ *                             void *userdata);
+ * __userdata: Any userdata to be passed along to the callback function.
+ *
+ * Values are visited in the order of the dense array.
+ */
+#define cslotmap_foreach(__s, __fun, __userdata)                              \
+  do                                                                          \
+  {                                                                           \
+    for (size_t __i = 0; __i < (__s).__b.__n; ++__i)                          \
+      __fun(cslotmap_handle_at(__s, __i), (__s).__vals[__i], (__userdata));   \
+  } while (0)
+
+/*
+ * cslotmap_size: Returns the number of values in the slot map.
+ *
+ * __s: The slot map.
+ */
+#define cslotmap_size(__s) (__s).__b.__n
+
+/*
+ * cslotmap_empty: Returns whether or not the slot map is empty.
+ *
+ * __s: The slot map.
+ */
+#define cslotmap_empty(__s) ((__s).__b.__n == 0)
+
+#endif /* __CSLOTMAP_H__ */
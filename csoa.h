@@ -0,0 +1,281 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A vector of records stored as one array per field (struct of arrays).
+ *
+ * A cvec_t of structs keeps every field of a record next to each other, so a
+ * loop that only reads one field still pulls whole records through the
+ * cache. A csoa_t keeps each field in its own contiguous column instead, and
+ * a scan over one field reads only that field's bytes. All columns share one
+ * size and capacity and live in a single allocation, so growing the vector
+ * is one allocation and one copy per column.
+ *
+ * The fields are given as an X-macro list of (type, name) pairs:
+ *
+ *    #define POINT_FIELDS(F) F(int, id) F(float, x) F(float, y)
+ *
+ *    CSOA_ROW(point, POINT_FIELDS)
+ *    CSOA_DECLARE(point, POINT_FIELDS)
+ *
+ *    csoa_t(point) pts = CSOA_INIT;
+ *    struct point p = {1, 0.5f, 2.0f};
+ *    point_soa_push_back(&pts, p);
+ *    float sum = 0;
+ *    for (size_t i = 0; i < csoa_size(pts); ++i)
+ *      sum += csoa_get(pts, x, i);
+ *    ...
+ *    point_soa_free(&pts);
+ *
+ * CSOA_ROW is only needed when struct point is not already defined
+ * elsewhere. If it is, the field list must name the same fields.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on these vectors too.
+ */
+
+#ifndef __CSOA_H__
+#define __CSOA_H__
+
+#include "cvec.h"
+
+/*
+ * Every column starts on a boundary of this many bytes, so columns never
+ * share a cache line. The block is over-allocated and its start rounded
+ * up to the first boundary.
+ */
+#define __CSOA_ALIGN 64
+
+/* Private macros expanded once per field of a list */
+#define __CSOA_ROW_FIELD(__T, __f) __T __f;
+#define __CSOA_COL_FIELD(__T, __f) __T *__f;
+#define __CSOA_ROW_SIZE(__T, __f) +sizeof(__T)
+#define __CSOA_COL_BYTES(__T, __f)                                            \
+  __bytes = (__bytes + __CSOA_ALIGN - 1) & ~(size_t)(__CSOA_ALIGN - 1);       \
+  __bytes += __n * sizeof(__T);
+#define __CSOA_COL_MOVE(__T, __f)                                             \
+  __off = (__off + __CSOA_ALIGN - 1) & ~(size_t)(__CSOA_ALIGN - 1);           \
+  if (__s->__n)                                                               \
+    memcpy(__base + __off, __s->__f, __s->__n * sizeof(__T));                 \
+  __s->__f = (__T *)(void *)(__base + __off);                                 \
+  __off += __n * sizeof(__T);
+#define __CSOA_COL_LOAD(__T, __f) __r.__f = __s->__f[__i];
+#define __CSOA_COL_STORE(__T, __f) __s->__f[__i] = __r.__f;
+
+/*
+ * csoa_t: The type of a vector declared with CSOA_DECLARE.
+ *
+ * __name: The name given to CSOA_DECLARE.
+ */
+#define csoa_t(__name) struct __name##_soa
+
+/*
+ * CSOA_INIT: Initializes all the fields of the vector struct.
+ */
+#define CSOA_INIT                                                             \
+  {                                                                           \
+    .__mem = NULL                                                             \
+  }
+
+/*
+ * CSOA_ROW: Declare the record type of a field list.
+ *
+ * __name:   The name of the record struct (struct __name).
+ * __fields: An X-macro taking a macro F and expanding to F(type, name) for
+ *           each field.
+ */
+#define CSOA_ROW(__name, __fields)                                            \
+  struct __name                                                               \
+  {                                                                           \
+    __fields(__CSOA_ROW_FIELD)                                                \
+  };
+
+/*
+ * CSOA_DECLARE: Declare a struct of arrays vector and its functions.
+ *
+ * __name:   The name of the record struct (struct __name), which must have
+ *           a member for each field of __fields.
+ * __fields: An X-macro taking a macro F and expanding to F(type, name) for
+ *           each field.
+ *
+ * This declares csoa_t(__name) and the following functions, which set the
+ * error field of the vector instead of failing when out of memory:
+ *
+ *    int __name_soa_reserve(csoa_t(__name) *s, size_t n);
+ *        Make room for at least n records. Returns zero on failure.
+ *    void __name_soa_push_back(csoa_t(__name) *s, struct __name r);
+ *        Append a record, writing each field to its column.
+ *    void __name_soa_pop_back(csoa_t(__name) *s);
+ *        Remove the last record.
+ *    struct __name __name_soa_row(const csoa_t(__name) *s, size_t i);
+ *        Gather record i from the columns. No bounds checking is done.
+ *    void __name_soa_set_row(csoa_t(__name) *s, size_t i, struct __name r);
+ *        Overwrite record i. No bounds checking is done.
+ *    void __name_soa_free(csoa_t(__name) *s);
+ *        Deallocate all the columns.
+ */
+#define CSOA_DECLARE(__name, __fields)                                        \
+  csoa_t(__name)                                                              \
+  {                                                                           \
+    char *__mem;                                                              \
+    size_t __n;                                                               \
+    size_t __m;                                                               \
+    int __e;                                                                  \
+    __fields(__CSOA_COL_FIELD)                                                \
+  };                                                                          \
+                                                                              \
+  static inline int                                                           \
+  __name##_soa_reserve(csoa_t(__name) *__s, size_t __n)                       \
+  {                                                                           \
+    size_t __bytes = 0;                                                       \
+    size_t __off = 0;                                                         \
+    char *__mem;                                                              \
+    char *__base;                                                             \
+                                                                              \
+    if (__n <= __s->__m)                                                      \
+      return 1;                                                               \
+    if (__n > (SIZE_MAX / 2) / (0 __fields(__CSOA_ROW_SIZE)))                 \
+    {                                                                         \
+      __s->__e = CVEC_EOOM;                                                   \
+      return 0;                                                               \
+    }                                                                         \
+    __fields(__CSOA_COL_BYTES)                                                \
+    __mem = malloc(__bytes + __CSOA_ALIGN - 1);                               \
+    if (!__mem)                                                               \
+    {                                                                         \
+      __s->__e = CVEC_EOOM;                                                   \
+      return 0;                                                               \
+    }                                                                         \
+    __base = (char *)(((uintptr_t)__mem + __CSOA_ALIGN - 1) &                 \
+                      ~(uintptr_t)(__CSOA_ALIGN - 1));                        \
+    __fields(__CSOA_COL_MOVE)                                                 \
+    free(__s->__mem);                                                         \
+    __s->__mem = __mem;                                                       \
+    __s->__m = __n;                                                           \
+    return 1;                                                                 \
+  }                                                                           \
+                                                                              \
+  static inline void                                                          \
+  __name##_soa_push_back(csoa_t(__name) *__s, struct __name __r)              \
+  {                                                                           \
+    size_t __i = __s->__n;                                                    \
+                                                                              \
+    if (__i == __s->__m &&                                                    \
+        !__name##_soa_reserve(__s, __s->__m ? __s->__m << 1 : 8))             \
+      return;                                                                 \
+    __fields(__CSOA_COL_STORE)                                                \
+    __s->__n = __i + 1;                                                       \
+  }                                                                           \
+                                                                              \
+  static inline void                                                          \
+  __name##_soa_pop_back(csoa_t(__name) *__s)                                  \
+  {                                                                           \
+    if (__s->__n > 0)                                                         \
+      --__s->__n;                                                             \
+  }                                                                           \
+                                                                              \
+  static inline struct __name                                                 \
+  __name##_soa_row(const csoa_t(__name) *__s, size_t __i)                     \
+  {                                                                           \
+    struct __name __r;                                                        \
+                                                                              \
+    __fields(__CSOA_COL_LOAD)                                                 \
+    return __r;                                                               \
+  }                                                                           \
+                                                                              \
+  static inline void                                                          \
+  __name##_soa_set_row(csoa_t(__name) *__s, size_t __i, struct __name __r)    \
+  {                                                                           \
+    __fields(__CSOA_COL_STORE)                                                \
+  }                                                                           \
+                                                                              \
+  static inline void                                                          \
+  __name##_soa_free(csoa_t(__name) *__s)                                      \
+  {                                                                           \
+    free(__s->__mem);                                                         \
+    memset(__s, 0, sizeof(*__s));                                             \
+  }
+
+/*
+ * csoa_col: Returns a pointer to the first item of a column.
+ *
+ * __s: The vector.
+ * __f: The name of the field.
+ *
+ * The column holds csoa_size(__s) items and moves when the vector grows.
+ */
+#define csoa_col(__s, __f) (__s).__f
+
+/*
+ * csoa_get: Get one field of a record.
+ *
+ * __s: The vector.
+ * __f: The name of the field.
+ * __i: The index of the record.
+ *
+ * Note that no bounds checking is performed here.
+ */
+#define csoa_get(__s, __f, __i) (__s).__f[(__i)]
+
+/*
+ * csoa_set: Set one field of a record.
+ *
+ * __s:    The vector.
+ * __f:    The name of the field.
+ * __i:    The index of the record.
+ * __item: The new value of the field.
+ *
+ * Note that no bounds checking is performed here.
+ */
+#define csoa_set(__s, __f, __i, __item) (__s).__f[(__i)] = (__item)
+
+/*
+ * csoa_clear: Remove all the records without releasing any memory.
+ *
+ * __s: The vector.
+ */
+#define csoa_clear(__s) (__s).__n = 0
+
+/*
+ * csoa_size: Returns the total number of records in the vector.
+ *
+ * __s: The vector.
+ */
+#define csoa_size(__s) (__s).__n
+
+/*
+ * csoa_cap: Returns the number of records the columns have room for.
+ *
+ * __s: The vector.
+ */
+#define csoa_cap(__s) (__s).__m
+
+/*
+ * csoa_empty: Returns whether or not the vector is empty.
+ *
+ * __s: The vector.
+ */
+#define csoa_empty(__s) ((__s).__n == 0)
+
+#endif /* __CSOA_H__ */
@@ -0,0 +1,259 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A set of small integer keys, after Briggs and Torczon.
+ *
+ * The members are kept packed in a cvec_t, and a sparse array indexed by
+ * key gives each member's position there. A key is a member when its
+ * sparse entry points inside the packed vector at that same key, so stale
+ * sparse entries are harmless: clearing the set only empties the packed
+ * vector and costs the same however large the keys are. Insert, erase and
+ * lookup are O(1), and iterating visits just the members:
+ *
+ *    csparseset_t dirty = CSPARSESET_INIT;
+ *    csparseset_reserve(dirty, nentities);
+ *    csparseset_insert(dirty, 42);
+ *    for (size_t i = 0; i < csparseset_size(dirty); ++i)
+ *      update(csparseset_at(dirty, i));
+ *    csparseset_clear(dirty);
+ *    ...
+ *    csparseset_free(dirty);
+ *
+ * The sparse array takes 4 bytes per possible key, up to the largest key
+ * inserted so far.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on sparse sets too.
+ */
+
+#ifndef __CSPARSESET_H__
+#define __CSPARSESET_H__
+
+#include "cvec.h"
+
+/*
+ * csparseset_t: The sparse set type.
+ *
+ * Members are in __dense in no particular order. __sparse has __u entries.
+ */
+typedef struct
+{
+  cvec_t(uint32_t) __dense;
+  uint32_t *__sparse;
+  size_t __u;
+  int __e;
+} csparseset_t;
+
+/*
+ * CSPARSESET_INIT: Initializes all the fields of the sparse set struct.
+ */
+#define CSPARSESET_INIT                                                       \
+  {                                                                           \
+    CVEC_INIT(uint32_t, 0, NULL), NULL, 0, CVEC_EOK                           \
+  }
+
+static inline int
+__csparseset_reserve(csparseset_t *s, size_t keys)
+{
+  size_t u = s->__u ? s->__u : 64;
+  uint32_t *sp;
+
+  if (keys <= s->__u)
+    return 1;
+  while (u < keys)
+    u <<= 1;
+  if (u > (size_t) UINT32_MAX + 1)
+    u = (size_t) UINT32_MAX + 1;
+  sp = realloc(s->__sparse, u * sizeof(uint32_t));
+  if (!sp)
+  {
+    s->__e = CVEC_EOOM;
+    return 0;
+  }
+  /*
+   * contains reads the entry of every key below __u, member or not, and
+   * checks it against the dense array. Zeroing keeps that read defined.
+   */
+  memset(sp + s->__u, 0, (u - s->__u) * sizeof(uint32_t));
+  s->__sparse = sp;
+  s->__u = u;
+  return 1;
+}
+
+static inline int
+__csparseset_contains(const csparseset_t *s, uint32_t k)
+{
+  uint32_t i;
+
+  if (k >= s->__u)
+    return 0;
+  i = s->__sparse[k];
+  return i < s->__dense.__n && s->__dense.__data[i] == k;
+}
+
+static inline int
+__csparseset_insert(csparseset_t *s, uint32_t k)
+{
+  size_t n = s->__dense.__n;
+
+  if (k >= s->__u && !__csparseset_reserve(s, (size_t) k + 1))
+    return 0;
+  if (__csparseset_contains(s, k))
+    return 0;
+  cvec_push_back(s->__dense, k);
+  if (s->__dense.__n == n)
+  {
+    s->__e = CVEC_EOOM;
+    return 0;
+  }
+  s->__sparse[k] = (uint32_t) n;
+  return 1;
+}
+
+static inline int
+__csparseset_erase(csparseset_t *s, uint32_t k)
+{
+  uint32_t i, last;
+
+  if (!__csparseset_contains(s, k))
+    return 0;
+  i = s->__sparse[k];
+  last = s->__dense.__data[--s->__dense.__n];
+  s->__dense.__data[i] = last;
+  s->__sparse[last] = i;
+  return 1;
+}
+
+/*
+ * csparseset_free: Deallocates all the memory associated with this set.
+ *
+ * __s: The sparse set.
+ */
+#define csparseset_free(__s)                                                  \
+  do                                                                          \
+  {                                                                           \
+    cvec_free((__s).__dense);                                                 \
+    free((__s).__sparse);                                                     \
+    (__s).__sparse = NULL;                                                    \
+    (__s).__u = 0;                                                            \
+    (__s).__e = CVEC_EOK;                                                     \
+  } while (0)
+
+/*
+ * csparseset_clear: Remove every member in constant time, without
+ * releasing any memory.
+ *
+ * __s: The sparse set.
+ */
+#define csparseset_clear(__s) ((__s).__dense.__n = 0)
+
+/*
+ * csparseset_reserve: Make room for keys below a bound ahead of time.
+ *
+ * __s:    The sparse set.
+ * __keys: One past the largest key to make room for.
+ */
+#define csparseset_reserve(__s, __keys)                                       \
+  (void) __csparseset_reserve(&(__s), (__keys))
+
+/*
+ * csparseset_insert: Add a key to the set.
+ *
+ * __s: The sparse set.
+ * __k: The key, a uint32_t.
+ *
+ * Returns non-zero if the key was added, or zero if it was already a
+ * member or memory ran out.
+ */
+#define csparseset_insert(__s, __k) __csparseset_insert(&(__s), (__k))
+
+/*
+ * csparseset_erase: Remove a key from the set. The last member takes its
+ * place in the packed order.
+ *
+ * __s: The sparse set.
+ * __k: The key.
+ *
+ * Returns non-zero if the key was removed, or zero if it was not a member.
+ */
+#define csparseset_erase(__s, __k) __csparseset_erase(&(__s), (__k))
+
+/*
+ * csparseset_contains: Returns whether or not a key is a member.
+ *
+ * __s: The sparse set.
+ * __k: The key.
+ */
+#define csparseset_contains(__s, __k) __csparseset_contains(&(__s), (__k))
+
+/*
+ * csparseset_size: Returns the number of members.
+ *
+ * __s: The sparse set.
+ */
+#define csparseset_size(__s) ((__s).__dense.__n)
+
+/*
+ * csparseset_empty: Returns whether or not the set has no members.
+ *
+ * __s: The sparse set.
+ */
+#define csparseset_empty(__s) ((__s).__dense.__n == 0)
+
+/*
+ * csparseset_at: Returns the member at a position in the packed order.
+ *
+ * __s: The sparse set.
+ * __i: The position, below csparseset_size.
+ */
+#define csparseset_at(__s, __i) ((__s).__dense.__data[(__i)])
+
+/*
+ * csparseset_data: Returns a pointer to the packed members, which must not
+ * be changed through it.
+ *
+ * __s: The sparse set.
+ */
+#define csparseset_data(__s) ((const uint32_t *) (__s).__dense.__data)
+
+/*
+ * csparseset_foreach: Calls a function with each member.
+ *
+ * __s:        The sparse set.
+ * __fun:      A callback function to be called on each member with the
+ *             following signature:
+ *                 void <func>(uint32_t key, void *userdata);
+ * __userdata: Any userdata to be passed along to the callback function.
+ *
+ * Members are visited in the packed order.
+ */
+#define csparseset_foreach(__s, __fun, __userdata)                            \
+  do                                                                          \
+  {                                                                           \
+    for (size_t __i = 0; __i < (__s).__dense.__n; ++__i)                      \
+      __fun((__s).__dense.__data[__i], (__userdata));                         \
+  } while (0)
+
+#endif /* __CSPARSESET_H__ */
@@ -0,0 +1,305 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A bounded lock-free queue for one producer thread and one consumer thread.
+ *
+ * The items live in a ring whose size is a power of two, so positions are
+ * free-running counters masked into the ring. The producer only writes the
+ * tail and the consumer only writes the head, each on its own cache line,
+ * and each side keeps a private copy of the other side's counter that it
+ * refreshes only when the ring looks full or empty. Most pushes and pops
+ * therefore touch no cache line that the other thread writes.
+ *
+ *    cspsc_t(int) q;
+ *    cspsc_init(q, int, 1024);
+ *
+ *    (producer)                          (consumer)
+ *    while (!cspsc_try_push(q, x))       int y;
+ *      ;                                 if (cspsc_try_pop(q, y))
+ *                                          ...
+ *
+ * cspsc_push_n and cspsc_pop_n move up to n items with one update of the
+ * shared counter, which amortizes its cost over the batch.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on queues too.
+ */
+
+#ifndef __CSPSC_H__
+#define __CSPSC_H__
+
+#include "cvec.h"
+
+#ifndef __CVEC_HAS_ATOMICS
+#error "cspsc.h needs C11 atomics or the GCC/Clang __atomic builtins"
+#endif
+
+/*
+ * The untyped part of a queue. The producer writes __tail and its copy of
+ * the head, and the consumer writes __head and its copy of the tail. The
+ * struct need not start on a cache line, so a full line of padding around
+ * each pair keeps them off each other's lines wherever the queue lives.
+ */
+struct __cspsc_base
+{
+  char __pad0[CVEC_CACHE_LINE];
+  __cvec_atomic(size_t) __tail;
+  size_t __head_cache;
+  char __pad1[CVEC_CACHE_LINE];
+  __cvec_atomic(size_t) __head;
+  size_t __tail_cache;
+  char __pad2[CVEC_CACHE_LINE];
+  size_t __mask;
+  size_t __t;
+};
+
+static inline int
+__cspsc_init(struct __cspsc_base *b, void **data, size_t t, size_t cap)
+{
+  size_t m = 1;
+
+  while (m < cap)
+    m <<= 1;
+  memset(b, 0, sizeof(*b));
+  b->__mask = m - 1;
+  b->__t = t;
+  *data = malloc(m * t);
+  return *data ? CVEC_EOK : CVEC_EOOM;
+}
+
+/* Producer side: returns how many of n items there is room for */
+static inline size_t
+__cspsc_room(struct __cspsc_base *b, size_t n)
+{
+  size_t tail = __cvec_load(&b->__tail, __CVEC_RELAXED);
+  size_t room = b->__mask + 1 - (tail - b->__head_cache);
+
+  if (room < n)
+  {
+    b->__head_cache = __cvec_load(&b->__head, __CVEC_ACQUIRE);
+    room = b->__mask + 1 - (tail - b->__head_cache);
+  }
+  return room < n ? room : n;
+}
+
+/* Consumer side: returns how many of n items are ready */
+static inline size_t
+__cspsc_ready(struct __cspsc_base *b, size_t n)
+{
+  size_t head = __cvec_load(&b->__head, __CVEC_RELAXED);
+  size_t ready = b->__tail_cache - head;
+
+  if (ready < n)
+  {
+    b->__tail_cache = __cvec_load(&b->__tail, __CVEC_ACQUIRE);
+    ready = b->__tail_cache - head;
+  }
+  return ready < n ? ready : n;
+}
+
+/*
+ * The head is read first, so it cannot pass the tail that is read after
+ * it. The tail may still have moved on by more than the capacity since.
+ */
+static inline size_t
+__cspsc_size(struct __cspsc_base *b)
+{
+  size_t head = __cvec_load(&b->__head, __CVEC_ACQUIRE);
+  size_t n = __cvec_load(&b->__tail, __CVEC_ACQUIRE) - head;
+
+  return n > b->__mask + 1 ? b->__mask + 1 : n;
+}
+
+/* The slot of the next push or pop */
+#define __cspsc_tail_slot(__b)                                                \
+  (__cvec_load(&(__b).__tail, __CVEC_RELAXED) & (__b).__mask)
+#define __cspsc_head_slot(__b)                                                \
+  (__cvec_load(&(__b).__head, __CVEC_RELAXED) & (__b).__mask)
+
+static inline void
+__cspsc_advance(__cvec_atomic(size_t) *counter, size_t n)
+{
+  __cvec_store(counter, __cvec_load(counter, __CVEC_RELAXED) + n,
+               __CVEC_RELEASE);
+}
+
+/* Copies n items between the ring and a flat array, wrapping once */
+static inline void
+__cspsc_copy(struct __cspsc_base *b, char *ring, size_t slot, char *flat,
+             size_t n, int into_ring)
+{
+  size_t first = b->__mask + 1 - slot;
+
+  if (first > n)
+    first = n;
+  if (into_ring)
+  {
+    memcpy(ring + slot * b->__t, flat, first * b->__t);
+    memcpy(ring, flat + first * b->__t, (n - first) * b->__t);
+  }
+  else
+  {
+    memcpy(flat, ring + slot * b->__t, first * b->__t);
+    memcpy(flat + first * b->__t, ring, (n - first) * b->__t);
+  }
+}
+
+static inline size_t
+__cspsc_push_n(struct __cspsc_base *b, void *ring, const void *items,
+               size_t n)
+{
+  n = __cspsc_room(b, n);
+  if (n)
+  {
+    __cspsc_copy(b, ring, __cspsc_tail_slot(*b), (char *) items, n, 1);
+    __cspsc_advance(&b->__tail, n);
+  }
+  return n;
+}
+
+static inline size_t
+__cspsc_pop_n(struct __cspsc_base *b, void *ring, void *items, size_t n)
+{
+  n = __cspsc_ready(b, n);
+  if (n)
+  {
+    __cspsc_copy(b, ring, __cspsc_head_slot(*b), items, n, 0);
+    __cspsc_advance(&b->__head, n);
+  }
+  return n;
+}
+
+/*
+ * cspsc_t: Declare a new queue type.
+ *
+ * __T: The type of items that the queue holds.
+ */
+#define cspsc_t(__T)                                                          \
+  struct                                                                      \
+  {                                                                           \
+    struct __cspsc_base __b;                                                  \
+    __T *__data;                                                              \
+    int __e;                                                                  \
+  }
+
+/*
+ * cspsc_init: Initializes an empty queue.
+ *
+ * __q:   The queue to initialize.
+ * __T:   The type of items that the queue holds.
+ * __cap: The number of items the queue can hold. This is rounded up to a
+ *        power of two.
+ */
+#define cspsc_init(__q, __T, __cap)                                           \
+  do                                                                          \
+  {                                                                           \
+    void *__qd;                                                               \
+    (__q).__e = __cspsc_init(&(__q).__b, &__qd, sizeof(__T), (__cap));        \
+    (__q).__data = __qd;                                                      \
+  } while (0)
+
+/*
+ * cspsc_free: Deallocates the ring of a queue.
+ *
+ * __q: The queue, which neither thread may use afterwards.
+ */
+#define cspsc_free(__q)                                                       \
+  do                                                                          \
+  {                                                                           \
+    free((__q).__data);                                                       \
+    (__q).__data = NULL;                                                      \
+  } while (0)
+
+/*
+ * cspsc_try_push: Add an item at the tail of the queue.
+ *
+ * __q:    The queue. Only the producer thread may call this.
+ * __item: The item to add.
+ *
+ * Returns non-zero if the item was added, or zero if the queue is full.
+ */
+#define cspsc_try_push(__q, __item)                                           \
+  (__cspsc_room(&(__q).__b, 1)                                                \
+       ? ((__q).__data[__cspsc_tail_slot((__q).__b)] = (__item),              \
+          __cspsc_advance(&(__q).__b.__tail, 1), 1)                           \
+       : 0)
+
+/*
+ * cspsc_try_pop: Remove the item at the head of the queue.
+ *
+ * __q:    The queue. Only the consumer thread may call this.
+ * __item: An lvalue to store the removed item in.
+ *
+ * Returns non-zero if an item was removed, or zero if the queue is empty.
+ */
+#define cspsc_try_pop(__q, __item)                                            \
+  (__cspsc_ready(&(__q).__b, 1)                                               \
+       ? ((__item) = (__q).__data[__cspsc_head_slot((__q).__b)],              \
+          __cspsc_advance(&(__q).__b.__head, 1), 1)                           \
+       : 0)
+
+/*
+ * cspsc_push_n: Add up to a number of items at the tail of the queue.
+ *
+ * __q:     The queue. Only the producer thread may call this.
+ * __items: A pointer to the items to add.
+ * __n:     The number of items at __items.
+ *
+ * Returns the number of items added, which is less than __n if the queue
+ * fills up. They become visible to the consumer all at once.
+ */
+#define cspsc_push_n(__q, __items, __n)                                       \
+  __cspsc_push_n(&(__q).__b, (__q).__data, (__items), (__n))
+
+/*
+ * cspsc_pop_n: Remove up to a number of items from the head of the queue.
+ *
+ * __q:     The queue. Only the consumer thread may call this.
+ * __items: A pointer to room for __n items to store the removed items in.
+ * __n:     The most items to remove.
+ *
+ * Returns the number of items removed.
+ */
+#define cspsc_pop_n(__q, __items, __n)                                        \
+  __cspsc_pop_n(&(__q).__b, (__q).__data, (__items), (__n))
+
+/*
+ * cspsc_size: Returns the number of items in the queue.
+ *
+ * __q: The queue.
+ *
+ * When the other thread is active this is only a snapshot, but it is
+ * never more than cspsc_cap.
+ */
+#define cspsc_size(__q) __cspsc_size(&(__q).__b)
+
+/*
+ * cspsc_cap: Returns the number of items the queue can hold.
+ *
+ * __q: The queue.
+ */
+#define cspsc_cap(__q) ((__q).__b.__mask + 1)
+
+#endif /* __CSPSC_H__ */
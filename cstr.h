@@ -0,0 +1,471 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A string builder.
+ *
+ * A cvec_t(char) works as a string, but text goes in one cvec_push_back at
+ * a time and nothing keeps it terminated. A cstr_t has the same size,
+ * capacity and error fields as a cvec_t, appends whole runs of bytes, and
+ * keeps a NUL after the last byte at all times, so cstr_cstr can be handed
+ * to any C function. Strings shorter than CSTR_SSO bytes are stored inside
+ * the struct itself and need no allocation:
+ *
+ *    cstr_t line = CSTR_INIT;
+ *    cstr_append_str(line, "request ");
+ *    cstr_append_uint(line, id);
+ *    cstr_appendf(line, " took %.3f ms", ms);
+ *    puts(cstr_cstr(line));
+ *    cstr_clear(line);
+ *    ...
+ *    cstr_free(line);
+ *
+ * cstr_appendf formats straight into the spare capacity and only formats a
+ * second time if that was too small. The integer appenders convert two
+ * digits at a time without going through printf.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on strings too. An append that runs out
+ * of memory leaves the string unchanged.
+ */
+
+#ifndef __CSTR_H__
+#define __CSTR_H__
+
+#include <float.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "cvec.h"
+
+/* The size of the inline buffer, including the NUL */
+#ifndef CSTR_SSO
+#define CSTR_SSO 24
+#endif
+
+/*
+ * cstr_t: The string type.
+ *
+ * __m is the capacity without the NUL. The bytes live in __u.__sso while
+ * __m is CSTR_SSO - 1, and in the heap block __u.__p once it is larger.
+ */
+typedef struct
+{
+  size_t __n;
+  size_t __m;
+  union
+  {
+    char *__p;
+    char __sso[CSTR_SSO];
+  } __u;
+  int __e;
+} cstr_t;
+
+/*
+ * CSTR_INIT: Initializes all the fields of the string struct.
+ */
+#define CSTR_INIT                                                             \
+  {                                                                           \
+    0, CSTR_SSO - 1, {NULL}, CVEC_EOK                                         \
+  }
+
+/* The bytes of a string, wherever they are stored */
+#define __cstr_ptr(__s)                                                       \
+  ((__s)->__m >= CSTR_SSO ? (__s)->__u.__p : (__s)->__u.__sso)
+
+/* Lets the compiler check the arguments of the printf-style appenders */
+#if defined(__GNUC__) || defined(__clang__)
+#define __cstr_printf(__fmt, __args)                                          \
+  __attribute__((format(printf, __fmt, __args)))
+#else
+#define __cstr_printf(__fmt, __args)
+#endif
+
+/* Two decimal digits for each number below 100 */
+static const char __cstr_digits[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/* Makes room for need bytes plus the NUL. Returns 1 on success. */
+static inline int
+__cstr_grow(cstr_t *s, size_t need)
+{
+  size_t m = s->__m * 2;
+  char *p;
+
+  if (need <= s->__m)
+    return 1;
+  if (m < need)
+    m = need;
+  if (s->__m >= CSTR_SSO)
+    p = realloc(s->__u.__p, m + 1);
+  else if ((p = malloc(m + 1)))
+    memcpy(p, s->__u.__sso, s->__n + 1);
+  if (!p)
+  {
+    s->__e = CVEC_EOOM;
+    return 0;
+  }
+  s->__u.__p = p;
+  s->__m = m;
+  return 1;
+}
+
+static inline void
+__cstr_append(cstr_t *s, const void *data, size_t len)
+{
+  char *p = __cstr_ptr(s);
+  uintptr_t off = (uintptr_t) data - (uintptr_t) p;
+
+  /* Growing moves the bytes, so a part of the string itself is refound */
+  if (!__cstr_grow(s, s->__n + len))
+    return;
+  if (off <= s->__n)
+    data = __cstr_ptr(s) + off;
+  p = __cstr_ptr(s);
+  memcpy(p + s->__n, data, len);
+  s->__n += len;
+  p[s->__n] = '\0';
+}
+
+static inline void
+__cstr_push_back(cstr_t *s, char c)
+{
+  char *p;
+
+  if (s->__n == s->__m && !__cstr_grow(s, s->__n + 1))
+    return;
+  p = __cstr_ptr(s);
+  p[s->__n++] = c;
+  p[s->__n] = '\0';
+}
+
+__cstr_printf(2, 0) static inline void
+__cstr_vappendf(cstr_t *s, const char *fmt, va_list ap)
+{
+  size_t room = s->__m - s->__n + 1;
+  va_list again;
+  int len;
+
+  va_copy(again, ap);
+  len = vsnprintf(__cstr_ptr(s) + s->__n, room, fmt, ap);
+  if (len >= 0 && (size_t) len >= room)
+  {
+    if (__cstr_grow(s, s->__n + len))
+      vsnprintf(__cstr_ptr(s) + s->__n, (size_t) len + 1, fmt, again);
+    else
+      len = -1;
+  }
+  va_end(again);
+  if (len >= 0)
+    s->__n += len;
+  __cstr_ptr(s)[s->__n] = '\0';
+}
+
+__cstr_printf(2, 3) static inline void
+__cstr_appendf(cstr_t *s, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  __cstr_vappendf(s, fmt, ap);
+  va_end(ap);
+}
+
+/* Writes x in decimal ending just before end and returns where it starts */
+static inline char *
+__cstr_utoa(char *end, uint64_t x)
+{
+  while (x >= 100)
+  {
+    end -= 2;
+    memcpy(end, __cstr_digits + (x % 100) * 2, 2);
+    x /= 100;
+  }
+  if (x >= 10)
+  {
+    end -= 2;
+    memcpy(end, __cstr_digits + x * 2, 2);
+  }
+  else
+    *--end = (char) ('0' + x);
+  return end;
+}
+
+static inline void
+__cstr_append_uint(cstr_t *s, uint64_t x)
+{
+  char buf[20];
+  char *p = __cstr_utoa(buf + sizeof(buf), x);
+
+  __cstr_append(s, p, (size_t) (buf + sizeof(buf) - p));
+}
+
+static inline void
+__cstr_append_int(cstr_t *s, int64_t x)
+{
+  char buf[21];
+  char *p = __cstr_utoa(buf + sizeof(buf),
+                        x < 0 ? -(uint64_t) x : (uint64_t) x);
+
+  if (x < 0)
+    *--p = '-';
+  __cstr_append(s, p, (size_t) (buf + sizeof(buf) - p));
+}
+
+static inline void
+__cstr_append_double(cstr_t *s, double x, int digits)
+{
+  static const double scale[] = {1e0, 1e1, 1e2, 1e3, 1e4,
+                                 1e5, 1e6, 1e7, 1e8, 1e9};
+  double a = x < 0 ? -x : x;
+  double y, r;
+  char buf[32];
+  char *p = buf + sizeof(buf);
+  uint64_t u, frac;
+
+  /* NaN, infinities and values too large to scale exactly go to printf */
+  if (digits < 0 || digits > 9 || !(a < 1e15 / scale[digits]))
+  {
+    __cstr_appendf(s, "%.*f", digits, x);
+    return;
+  }
+
+  /*
+   * y is a * 10^digits off by at most half an ulp. Unless its fraction is
+   * within an ulp of one half, it rounds the same way as the exact product.
+   * Ties and near-ties go to printf, which rounds the exact value.
+   */
+  y = a * scale[digits];
+  u = (uint64_t) y;
+  r = y - (double) u;
+  if (r - 0.5 <= y * DBL_EPSILON && 0.5 - r <= y * DBL_EPSILON)
+  {
+    __cstr_appendf(s, "%.*f", digits, x);
+    return;
+  }
+  u += r > 0.5;
+  if (digits)
+  {
+    frac = u % (uint64_t) scale[digits];
+    u /= (uint64_t) scale[digits];
+    for (int i = 0; i < digits; ++i, frac /= 10)
+      *--p = (char) ('0' + frac % 10);
+    *--p = '.';
+  }
+  p = __cstr_utoa(p, u);
+  if (signbit(x))
+    *--p = '-';
+  __cstr_append(s, p, (size_t) (buf + sizeof(buf) - p));
+}
+
+/*
+ * cstr_init: Initializes all the fields of the string struct.
+ *
+ * __s: The string to initialize.
+ */
+#define cstr_init(__s)                                                        \
+  do                                                                          \
+  {                                                                           \
+    (__s).__n = 0;                                                            \
+    (__s).__m = CSTR_SSO - 1;                                                 \
+    (__s).__u.__sso[0] = '\0';                                                \
+    (__s).__e = CVEC_EOK;                                                     \
+  } while (0)
+
+/*
+ * cstr_free: Deallocates all the memory associated with this string.
+ *
+ * __s: The string, which is left empty and usable.
+ */
+#define cstr_free(__s)                                                        \
+  do                                                                          \
+  {                                                                           \
+    if ((__s).__m >= CSTR_SSO)                                                \
+      free((__s).__u.__p);                                                    \
+    cstr_init(__s);                                                           \
+  } while (0)
+
+/*
+ * cstr_clear: Set the length of the string to zero.
+ *
+ * __s: The string.
+ *
+ * The capacity of the string is left unchanged.
+ */
+#define cstr_clear(__s)                                                       \
+  do                                                                          \
+  {                                                                           \
+    (__s).__n = 0;                                                            \
+    __cstr_ptr(&(__s))[0] = '\0';                                             \
+  } while (0)
+
+/*
+ * cstr_truncate: Shorten the string.
+ *
+ * __s:   The string.
+ * __len: The new length. Nothing happens if it is not below the current
+ *        length.
+ */
+#define cstr_truncate(__s, __len)                                             \
+  do                                                                          \
+  {                                                                           \
+    if ((__len) < (__s).__n)                                                  \
+    {                                                                         \
+      (__s).__n = (__len);                                                    \
+      __cstr_ptr(&(__s))[(__s).__n] = '\0';                                   \
+    }                                                                         \
+  } while (0)
+
+/*
+ * cstr_reserve: Reserve memory ahead of time.
+ *
+ * __s:   The string.
+ * __len: The length to make room for, not counting the NUL.
+ */
+#define cstr_reserve(__s, __len) (void) __cstr_grow(&(__s), (__len))
+
+/*
+ * cstr_append: Append bytes to the end of the string.
+ *
+ * __s:    The string.
+ * __data: A pointer to the bytes, which may contain NULs. It may point
+ *         into the string itself.
+ * __len:  The number of bytes.
+ */
+#define cstr_append(__s, __data, __len)                                       \
+  __cstr_append(&(__s), (__data), (__len))
+
+/*
+ * cstr_append_str: Append a NUL terminated string.
+ *
+ * __s:   The string.
+ * __str: The string to append, which may be part of __s itself.
+ */
+#define cstr_append_str(__s, __str)                                           \
+  do                                                                          \
+  {                                                                           \
+    const char *__as = (__str);                                               \
+    __cstr_append(&(__s), __as, strlen(__as));                                \
+  } while (0)
+
+/*
+ * cstr_push_back: Append one character.
+ *
+ * __s: The string.
+ * __c: The character.
+ */
+#define cstr_push_back(__s, __c) __cstr_push_back(&(__s), (__c))
+
+/*
+ * cstr_appendf: Append text formatted as by printf.
+ *
+ * __s:   The string.
+ * __fmt: The format, followed by its arguments. Unlike with cstr_append,
+ *        none of them may point into __s itself.
+ */
+#define cstr_appendf(__s, ...) __cstr_appendf(&(__s), __VA_ARGS__)
+
+/*
+ * cstr_vappendf: Append text formatted as by vprintf.
+ *
+ * __s:   The string.
+ * __fmt: The format.
+ * __ap:  The arguments, none of which may point into __s itself.
+ */
+#define cstr_vappendf(__s, __fmt, __ap)                                       \
+  __cstr_vappendf(&(__s), (__fmt), (__ap))
+
+/*
+ * cstr_append_uint: Append an unsigned integer in decimal.
+ *
+ * __s: The string.
+ * __x: The integer, up to 64 bits.
+ */
+#define cstr_append_uint(__s, __x) __cstr_append_uint(&(__s), (__x))
+
+/*
+ * cstr_append_int: Append a signed integer in decimal.
+ *
+ * __s: The string.
+ * __x: The integer, up to 64 bits.
+ */
+#define cstr_append_int(__s, __x) __cstr_append_int(&(__s), (__x))
+
+/*
+ * cstr_append_double: Append a floating point number with a fixed number
+ * of decimals, as by "%.*f".
+ *
+ * __s:      The string.
+ * __x:      The number.
+ * __digits: The number of decimals.
+ *
+ * Up to 9 decimals of numbers below 1e15 are converted without printf,
+ * unless __x lies at or very near halfway between two results.
+ */
+#define cstr_append_double(__s, __x, __digits)                                \
+  __cstr_append_double(&(__s), (__x), (__digits))
+
+/*
+ * cstr_cstr: Returns the contents as a NUL terminated string.
+ *
+ * __s: The string.
+ *
+ * The pointer stays valid until the string next grows or is freed.
+ */
+#define cstr_cstr(__s) ((const char *) __cstr_ptr(&(__s)))
+
+/*
+ * cstr_data: Returns a pointer to the bytes of the string, which may be
+ * changed in place.
+ *
+ * __s: The string.
+ */
+#define cstr_data(__s) __cstr_ptr(&(__s))
+
+/*
+ * cstr_size: Returns the length of the string, not counting the NUL.
+ *
+ * __s: The string.
+ */
+#define cstr_size(__s) ((__s).__n)
+
+/*
+ * cstr_cap: Returns the length the string can grow to without allocating.
+ *
+ * __s: The string.
+ */
+#define cstr_cap(__s) ((__s).__m)
+
+/*
+ * cstr_empty: Returns whether or not the string is empty.
+ *
+ * __s: The string.
+ */
+#define cstr_empty(__s) ((__s).__n == 0)
+
+#endif /* __CSTR_H__ */
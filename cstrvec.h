@@ -0,0 +1,368 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A vector of strings packed into one buffer.
+ *
+ * A cvec_t(char *) of strdup'ed strings makes one allocation per string and
+ * needs an __on_free call per item to release them. A cstrvec_t appends
+ * every string, with its NUL, to a single cvec_t(char) and records where
+ * each one ends in a cvec_t of offsets, so pushing a string is a copy into
+ * spare capacity, clearing is O(1), and freeing is one free per buffer:
+ *
+ *    cstrvec_t args = CSTRVEC_INIT;
+ *    for (int i = 1; i < argc; ++i)
+ *      cstrvec_push_str(args, argv[i]);
+ *    for (size_t i = 0; i < cstrvec_size(args); ++i)
+ *      printf("%s (%zu)\n", cstrvec_get(args, i), cstrvec_len(args, i));
+ *    cstrvec_free(args);
+ *
+ * Offsets are 32 bits, limiting the buffer to 4 GiB, unless CSTRVEC_WIDE is
+ * defined before including this header. Pointers into the buffer stay
+ * valid until the next push.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on string vectors too.
+ */
+
+#ifndef __CSTRVEC_H__
+#define __CSTRVEC_H__
+
+#include "cvec.h"
+
+/* The type of the offsets into the buffer */
+#ifdef CSTRVEC_WIDE
+typedef uint64_t cstrvec_off_t;
+#define __CSTRVEC_OFF_MAX UINT64_MAX
+#else
+typedef uint32_t cstrvec_off_t;
+#define __CSTRVEC_OFF_MAX UINT32_MAX
+#endif
+
+/*
+ * cstrvec_t: The string vector type.
+ *
+ * __ends holds, for each string, the offset just past its NUL.
+ */
+typedef struct
+{
+  cvec_t(char) __bytes;
+  cvec_t(cstrvec_off_t) __ends;
+  int __e;
+} cstrvec_t;
+
+/*
+ * cstrvec_view_t: A string in a string vector and its length.
+ */
+typedef struct
+{
+  const char *str;
+  size_t len;
+} cstrvec_view_t;
+
+/*
+ * CSTRVEC_INIT: Initializes all the fields of the string vector struct.
+ */
+#define CSTRVEC_INIT                                                          \
+  {                                                                           \
+    CVEC_INIT(char, '\0', NULL), CVEC_INIT(cstrvec_off_t, 0, NULL), CVEC_EOK  \
+  }
+
+static inline void
+__cstrvec_push(cstrvec_t *sv, const char *str, size_t len)
+{
+  size_t end = sv->__bytes.__n + len + 1;
+  uintptr_t off = (uintptr_t) str - (uintptr_t) sv->__bytes.__data;
+  int ok = 0;
+
+  if (len >= __CSTRVEC_OFF_MAX || end > __CSTRVEC_OFF_MAX)
+  {
+    sv->__e = CVEC_EOOM;
+    return;
+  }
+  do
+  {
+    __cvec_grow_to(sv->__bytes, end);
+    __cvec_grow_to(sv->__ends, sv->__ends.__n + 1);
+    ok = 1;
+  } while (0);
+  if (!ok)
+  {
+    sv->__e = CVEC_EOOM;
+    return;
+  }
+  /* Growing moves the bytes, so a string already stored is refound */
+  if (off <= sv->__bytes.__n)
+    str = sv->__bytes.__data + off;
+  if (len)
+    memcpy(sv->__bytes.__data + sv->__bytes.__n, str, len);
+  sv->__bytes.__data[end - 1] = '\0';
+  sv->__bytes.__n = end;
+  sv->__ends.__data[sv->__ends.__n++] = (cstrvec_off_t) end;
+}
+
+/* The offset where string i starts */
+static inline size_t
+__cstrvec_start(const cstrvec_t *sv, size_t i)
+{
+  return i ? (size_t) sv->__ends.__data[i - 1] : 0;
+}
+
+static inline cstrvec_view_t
+__cstrvec_view(const cstrvec_t *sv, size_t i)
+{
+  size_t start = __cstrvec_start(sv, i);
+  cstrvec_view_t v;
+
+  v.str = sv->__bytes.__data + start;
+  v.len = sv->__ends.__data[i] - start - 1;
+  return v;
+}
+
+static inline void
+__cstrvec_sort(cstrvec_t *sv)
+{
+  size_t n = sv->__ends.__n;
+  struct __cvec_skey *keys;
+  char *bytes;
+  cstrvec_off_t *ends;
+  size_t pos = 0;
+
+  if (n < 2)
+    return;
+  keys = malloc(n * sizeof(*keys));
+  bytes = malloc(sv->__bytes.__n);
+  ends = malloc(n * sizeof(*ends));
+  if (!keys || !bytes || !ends)
+  {
+    free(keys);
+    free(bytes);
+    free(ends);
+    sv->__e = CVEC_EOOM;
+    return;
+  }
+  for (size_t i = 0; i < n; ++i)
+  {
+    keys[i].__str =
+        (const unsigned char *) sv->__bytes.__data + __cstrvec_start(sv, i);
+    keys[i].__idx = i;
+  }
+  __cvec_skey_sort(keys, n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    size_t j = keys[i].__idx;
+    size_t start = __cstrvec_start(sv, j);
+    size_t len = sv->__ends.__data[j] - start;
+
+    memcpy(bytes + pos, sv->__bytes.__data + start, len);
+    pos += len;
+    ends[i] = (cstrvec_off_t) pos;
+  }
+  free(keys);
+  free(sv->__bytes.__data);
+  free(sv->__ends.__data);
+  sv->__bytes.__data = bytes;
+  sv->__bytes.__m = sv->__bytes.__n;
+  sv->__ends.__data = ends;
+  sv->__ends.__m = n;
+}
+
+/*
+ * cstrvec_init: Initializes all the fields of the string vector struct.
+ *
+ * __sv: The string vector to initialize.
+ */
+#define cstrvec_init(__sv)                                                    \
+  do                                                                          \
+  {                                                                           \
+    cvec_init((__sv).__bytes, char, '\0', NULL);                              \
+    cvec_init((__sv).__ends, cstrvec_off_t, 0, NULL);                         \
+    (__sv).__e = CVEC_EOK;                                                    \
+  } while (0)
+
+/*
+ * cstrvec_free: Deallocates all the memory associated with this string
+ * vector.
+ *
+ * __sv: The string vector.
+ */
+#define cstrvec_free(__sv)                                                    \
+  do                                                                          \
+  {                                                                           \
+    cvec_free((__sv).__bytes);                                                \
+    cvec_free((__sv).__ends);                                                 \
+    (__sv).__e = CVEC_EOK;                                                    \
+  } while (0)
+
+/*
+ * cstrvec_clear: Remove every string without releasing any memory.
+ *
+ * __sv: The string vector.
+ */
+#define cstrvec_clear(__sv)                                                   \
+  do                                                                          \
+  {                                                                           \
+    (__sv).__bytes.__n = 0;                                                   \
+    (__sv).__ends.__n = 0;                                                    \
+  } while (0)
+
+/*
+ * cstrvec_reserve: Reserve memory ahead of time.
+ *
+ * __sv:     The string vector.
+ * __count:  The number of strings to make room for.
+ * __nbytes: The number of bytes to make room for, counting one NUL for each
+ *           string.
+ */
+#define cstrvec_reserve(__sv, __count, __nbytes)                              \
+  do                                                                          \
+  {                                                                           \
+    int __ok = 0;                                                             \
+    do                                                                        \
+    {                                                                         \
+      __cvec_grow_to((__sv).__bytes, (__nbytes));                             \
+      __cvec_grow_to((__sv).__ends, (__count));                               \
+      __ok = 1;                                                               \
+    } while (0);                                                              \
+    if (!__ok)                                                                \
+      (__sv).__e = CVEC_EOOM;                                                 \
+  } while (0)
+
+/*
+ * cstrvec_push: Append a string given by a pointer and a length.
+ *
+ * __sv:  The string vector.
+ * __str: A pointer to the bytes of the string, which may point into __sv
+ *        itself.
+ * __len: The number of bytes, not counting any NUL.
+ */
+#define cstrvec_push(__sv, __str, __len)                                      \
+  __cstrvec_push(&(__sv), (__str), (__len))
+
+/*
+ * cstrvec_push_str: Append a NUL terminated string.
+ *
+ * __sv:  The string vector.
+ * __str: The string, which may be one stored in __sv itself.
+ */
+#define cstrvec_push_str(__sv, __str)                                         \
+  do                                                                          \
+  {                                                                           \
+    const char *__ps = (__str);                                               \
+    __cstrvec_push(&(__sv), __ps, strlen(__ps));                              \
+  } while (0)
+
+/*
+ * cstrvec_pop_back: Remove the last string.
+ *
+ * __sv: The string vector.
+ */
+#define cstrvec_pop_back(__sv)                                                \
+  do                                                                          \
+  {                                                                           \
+    if ((__sv).__ends.__n > 0)                                                \
+      (__sv).__bytes.__n = __cstrvec_start(&(__sv), --(__sv).__ends.__n);     \
+  } while (0)
+
+/*
+ * cstrvec_get: Returns a string as a NUL terminated const char *.
+ *
+ * __sv: The string vector.
+ * __i:  The index of the string, below cstrvec_size.
+ */
+#define cstrvec_get(__sv, __i)                                                \
+  ((const char *) (__sv).__bytes.__data + __cstrvec_start(&(__sv), (__i)))
+
+/*
+ * cstrvec_len: Returns the length of a string, not counting the NUL.
+ *
+ * __sv: The string vector.
+ * __i:  The index of the string, below cstrvec_size.
+ */
+#define cstrvec_len(__sv, __i)                                                \
+  ((size_t) (__sv).__ends.__data[(__i)] - __cstrvec_start(&(__sv), (__i)) - 1)
+
+/*
+ * cstrvec_view: Returns a string and its length as a cstrvec_view_t.
+ *
+ * __sv: The string vector.
+ * __i:  The index of the string, below cstrvec_size.
+ */
+#define cstrvec_view(__sv, __i) __cstrvec_view(&(__sv), (__i))
+
+/*
+ * cstrvec_sort: Sort the strings.
+ *
+ * __sv: The string vector.
+ *
+ * Strings are ordered as by cvec_sort_strings. The sorted strings are
+ * written to a new buffer, so the string vector is left unchanged apart
+ * from its error if that cannot be allocated.
+ */
+#define cstrvec_sort(__sv) __cstrvec_sort(&(__sv))
+
+/*
+ * cstrvec_foreach: Calls a function with each string.
+ *
+ * __sv:       The string vector.
+ * __fun:      A callback function to be called on each string with the
+ *             following signature:
+ *                 void <func>(const char *str, size_t len, void *userdata);
+ * __userdata: Any userdata to be passed along to the callback function.
+ */
+#define cstrvec_foreach(__sv, __fun, __userdata)                              \
+  do                                                                          \
+  {                                                                           \
+    size_t __fs = 0;                                                          \
+    for (size_t __i = 0; __i < (__sv).__ends.__n; ++__i)                      \
+    {                                                                         \
+      size_t __fe = (__sv).__ends.__data[__i];                                \
+      __fun((__sv).__bytes.__data + __fs, __fe - __fs - 1, (__userdata));     \
+      __fs = __fe;                                                            \
+    }                                                                         \
+  } while (0)
+
+/*
+ * cstrvec_size: Returns the number of strings.
+ *
+ * __sv: The string vector.
+ */
+#define cstrvec_size(__sv) ((__sv).__ends.__n)
+
+/*
+ * cstrvec_empty: Returns whether or not the string vector is empty.
+ *
+ * __sv: The string vector.
+ */
+#define cstrvec_empty(__sv) ((__sv).__ends.__n == 0)
+
+/*
+ * cstrvec_bytes: Returns the number of bytes used by all the strings,
+ * counting their NULs.
+ *
+ * __sv: The string vector.
+ */
+#define cstrvec_bytes(__sv) ((__sv).__bytes.__n)
+
+#endif /* __CSTRVEC_H__ */
@@ -49,12 +49,128 @@
 #ifndef __CVEC_H__
 #define __CVEC_H__
 
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define CVEC_EOK 0
 #define CVEC_EOOM -1 /* Out Of Memory */
 
+/*
+ * Atomic operations, used for the reference counts of shared buffers and by
+ * the concurrent containers. __CVEC_HAS_ATOMICS is defined when the
+ * compiler provides either the GCC/Clang __atomic builtins or C11 atomics.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define __CVEC_HAS_ATOMICS 1
+#define __cvec_atomic(__T) __T
+#define __CVEC_RELAXED __ATOMIC_RELAXED
+#define __CVEC_ACQUIRE __ATOMIC_ACQUIRE
+#define __CVEC_RELEASE __ATOMIC_RELEASE
+#define __CVEC_ACQ_REL __ATOMIC_ACQ_REL
+#define __CVEC_SEQ_CST __ATOMIC_SEQ_CST
+#define __cvec_load(__p, __mo) __atomic_load_n((__p), (__mo))
+#define __cvec_store(__p, __x, __mo) __atomic_store_n((__p), (__x), (__mo))
+#define __cvec_xchg(__p, __x, __mo) __atomic_exchange_n((__p), (__x), (__mo))
+#define __cvec_fetch_add(__p, __x, __mo)                                      \
+  __atomic_fetch_add((__p), (__x), (__mo))
+#define __cvec_fetch_sub(__p, __x, __mo)                                      \
+  __atomic_fetch_sub((__p), (__x), (__mo))
+#define __cvec_cas(__p, __expected, __x, __mo)                                \
+  __atomic_compare_exchange_n((__p), (__expected), (__x), 1, (__mo),          \
+                              __ATOMIC_RELAXED)
+#define __cvec_fence(__mo) __atomic_thread_fence(__mo)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L &&             \
+    !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define __CVEC_HAS_ATOMICS 1
+#define __cvec_atomic(__T) _Atomic(__T)
+#define __CVEC_RELAXED memory_order_relaxed
+#define __CVEC_ACQUIRE memory_order_acquire
+#define __CVEC_RELEASE memory_order_release
+#define __CVEC_ACQ_REL memory_order_acq_rel
+#define __CVEC_SEQ_CST memory_order_seq_cst
+#define __cvec_load(__p, __mo) atomic_load_explicit((__p), (__mo))
+#define __cvec_store(__p, __x, __mo)                                          \
+  atomic_store_explicit((__p), (__x), (__mo))
+#define __cvec_xchg(__p, __x, __mo)                                           \
+  atomic_exchange_explicit((__p), (__x), (__mo))
+#define __cvec_fetch_add(__p, __x, __mo)                                      \
+  atomic_fetch_add_explicit((__p), (__x), (__mo))
+#define __cvec_fetch_sub(__p, __x, __mo)                                      \
+  atomic_fetch_sub_explicit((__p), (__x), (__mo))
+#define __cvec_cas(__p, __expected, __x, __mo)                                \
+  atomic_compare_exchange_weak_explicit((__p), (__expected), (__x), (__mo),   \
+                                        memory_order_relaxed)
+#define __cvec_fence(__mo) atomic_thread_fence(__mo)
+#else
+/* Without atomics, vectors sharing a buffer must stay on one thread */
+#define __cvec_atomic(__T) __T
+#define __CVEC_RELAXED 0
+#define __CVEC_ACQUIRE 0
+#define __CVEC_ACQ_REL 0
+#define __cvec_load(__p, __mo) (*(__p))
+#define __cvec_fetch_add(__p, __x, __mo) ((*(__p) += (__x)) - (__x))
+#define __cvec_fetch_sub(__p, __x, __mo) ((*(__p) -= (__x)) + (__x))
+#endif
+
+/*
+ * Vectors can share one buffer after cvec_share. The buffer then has a
+ * reference count, and a vector copies the buffer before its first change.
+ */
+typedef __cvec_atomic(size_t) __cvec_rc_t;
+#define __cvec_rc_inc(__p) __cvec_fetch_add((__p), 1, __CVEC_RELAXED)
+#define __cvec_rc_dec(__p) (__cvec_fetch_sub((__p), 1, __CVEC_ACQ_REL) - 1)
+#define __cvec_rc_get(__p) __cvec_load((__p), __CVEC_ACQUIRE)
+
+/*
+ * Gives a vector a buffer of its own if it shares one, so it can be
+ * changed in place.
+ */
+#define __cvec_unshare(__v)                                                   \
+  if ((__v).__rc)                                                             \
+  {                                                                           \
+    if (__cvec_rc_get((__v).__rc) > 1)                                        \
+    {                                                                         \
+      void *__ud = malloc((__v).__t * ((__v).__m ? (__v).__m : 1));           \
+      if (!__ud)                                                              \
+      {                                                                       \
+        (__v).__e = CVEC_EOOM;                                                \
+        break;                                                                \
+      }                                                                       \
+      if ((__v).__n)                                                          \
+        memcpy(__ud, (__v).__data, (__v).__t * (__v).__n);                    \
+      if (__cvec_rc_dec((__v).__rc) == 0)                                     \
+      {                                                                       \
+        free((__v).__data);                                                   \
+        free((__v).__rc);                                                     \
+      }                                                                       \
+      (__v).__data = __ud;                                                    \
+    }                                                                         \
+    else                                                                      \
+      free((__v).__rc);                                                       \
+    (__v).__rc = NULL;                                                        \
+  }
+
+/*
+ * Drops a shared buffer without touching it, leaving the vector empty, or
+ * takes sole ownership of it if this was the last reference.
+ */
+#define __cvec_release(__v)                                                   \
+  if ((__v).__rc)                                                             \
+  {                                                                           \
+    if (__cvec_rc_dec((__v).__rc) == 0)                                       \
+      free((__v).__rc);                                                       \
+    else                                                                      \
+    {                                                                         \
+      (__v).__data = NULL;                                                    \
+      (__v).__n = 0;                                                          \
+      (__v).__m = 0;                                                          \
+    }                                                                         \
+    (__v).__rc = NULL;                                                        \
+  }
+
 /* A private macro that is undefined later */
 #define __cvec_maybe_grow(__v)                                                \
   if ((__v).__n == (__v).__m)                                                 \
@@ -71,6 +187,36 @@
     }                                                                         \
   }
 
+/*
+ * Grows the capacity to at least __need, or sets the error and breaks out
+ * of the enclosing loop.
+ */
+#define __cvec_grow_to(__v, __need)                                           \
+  if ((__need) > (__v).__m)                                                   \
+  {                                                                           \
+    size_t __gm = (__v).__m ? (__v).__m : 2;                                  \
+    void *__gd;                                                               \
+    while (__gm < (__need))                                                   \
+      __gm <<= 1;                                                             \
+    __gd = realloc((__v).__data, (__v).__t * __gm);                           \
+    if (!__gd)                                                                \
+    {                                                                         \
+      (__v).__e = CVEC_EOOM;                                                  \
+      break;                                                                  \
+    }                                                                         \
+    (__v).__data = __gd;                                                      \
+    (__v).__m = __gm;                                                         \
+  }
+
+/*
+ * Checks that __p points to items of the type __q points to. A different
+ * size fails to compile, and a different type of the same size warns.
+ * Neither pointer is evaluated.
+ */
+#define __cvec_check_item(__p, __q)                                           \
+  ((void) sizeof(char[sizeof(*(__p)) == sizeof(*(__q)) ? 1 : -1]),            \
+   (void) sizeof(0 ? (__p) : (__q)))
+
 /*
  * cvec_iter_t: Returns the type of iterator for a vector of type __T.
  *
@@ -93,6 +239,7 @@
     void (*__on_free)(__T);                                                   \
     int __e;                                                                  \
     __T __sentinel;                                                           \
+    __cvec_rc_t *__rc;                                                        \
   }
 
 /*
@@ -106,7 +253,7 @@
  */
 #define CVEC_INIT(__T, __sentinel_value, __on_free)                           \
   {                                                                           \
-    0, 0, sizeof(__T), NULL, (__on_free), CVEC_EOK, (__sentinel_value)        \
+    0, 0, sizeof(__T), NULL, (__on_free), CVEC_EOK, (__sentinel_value), NULL  \
   }
 
 /*
@@ -116,29 +263,30 @@
  * __T:              The type of items that the vector contains.
  * __sentinel_value: A default value that can be used
  *                   as a fallback in case of an error.
- * __on_free:        A function to be called on an item of the
+ * __free_fn:        A function to be called on an item of the
  *                   vector when it is destroyed.
  */
-#define cvec_init(__v, __T, __sentinel_value, __on_free)                      \
+#define cvec_init(__v, __T, __sentinel_value, __free_fn)                      \
   do                                                                          \
   {                                                                           \
     (__v).__n = 0;                                                            \
     (__v).__m = 0;                                                            \
     (__v).__t = sizeof(__T);                                                  \
     (__v).__data = NULL;                                                      \
-    (__v).__on_free = (__on_free);                                            \
+    (__v).__on_free = (__free_fn);                                            \
     (__v).__e = CVEC_EOK;                                                     \
     (__v).__sentinel = (__sentinel_value);                                    \
+    (__v).__rc = NULL;                                                        \
   } while (0)
 
 /*
  * cvec_set_on_free: Set the function to be called when an item is destroyed.
  *
  * __v:       The vector.
- * __on_free: A function to be called on an item of the
+ * __free_fn: A function to be called on an item of the
  *            vector when it is destroyed.
  */
-#define cvec_set_on_free(__v, __on_free) (__v).__on_free = (__on_free)
+#define cvec_set_on_free(__v, __free_fn) (__v).__on_free = (__free_fn)
 
 /*
  * cvec_free: Deallocates all the memory associated with this vector.
@@ -150,6 +298,7 @@
 #define cvec_free(__v)                                                        \
   do                                                                          \
   {                                                                           \
+    __cvec_release(__v);                                                      \
     if ((__v).__on_free && (__v).__data)                                      \
       for (size_t __i = 0; __i < (__v).__n; ++__i)                            \
         (__v).__on_free((__v).__data[__i]);                                   \
@@ -169,6 +318,7 @@
 #define cvec_reserve(__v, __n)                                                \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     (__v).__data = realloc((__v).__data, (__v).__t * (__n));                  \
     if (!(__v).__data)                                                        \
       (__v).__e = CVEC_EOOM;                                                  \
@@ -186,8 +336,9 @@
 #define cvec_clear(__v)                                                       \
   do                                                                          \
   {                                                                           \
+    __cvec_release(__v);                                                      \
     if ((__v).__on_free)                                                      \
-      for (size_t __i = 0; __i < (__v).__n; ++i)                              \
+      for (size_t __i = 0; __i < (__v).__n; ++__i)                            \
         (__v).__on_free((__v).__data[__i]);                                   \
     (__v).__n = 0;                                                            \
   } while (0)
@@ -202,10 +353,11 @@
 #define cvec_insert(__v, __pos, __item)                                       \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     size_t __p = (__pos);                                                     \
     __cvec_maybe_grow(__v);                                                   \
-    memcpy((__v).__data + (__p + 1), (__v).__data + __p,                      \
-           (__v).__t * ((__v).__n++ - __p));                                  \
+    memmove((__v).__data + (__p + 1), (__v).__data + __p,                     \
+            (__v).__t * ((__v).__n++ - __p));                                 \
     (__v).__data[__p] = (__item);                                             \
   } while (0)
 
@@ -218,13 +370,43 @@
 #define cvec_erase(__v, __pos)                                                \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     if ((__v).__n > 0)                                                        \
     {                                                                         \
       size_t __p = (__pos);                                                   \
       if ((__v).__on_free)                                                    \
         (__v).__on_free((__v).__data[__p]);                                   \
-      memcpy((__v).__data + __p, (__v).__data + (__p + 1),                    \
-             (__v).__t * ((__v).__n-- - (__p - 1)));                          \
+      memmove((__v).__data + __p, (__v).__data + (__p + 1),                   \
+              (__v).__t * (--(__v).__n - __p));                               \
+    }                                                                         \
+  } while (0)
+
+/*
+ * cvec_erase_range: Erase a range of items in a vector.
+ *
+ * __v:     The vector.
+ * __first: The position of the first item to erase.
+ * __last:  The position one past the last item to erase.
+ *
+ * A __last beyond the end of the vector is treated as the end. If __on_free
+ * is not null, then it is called on each erased item.
+ */
+#define cvec_erase_range(__v, __first, __last)                                \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    size_t __ef = (__first);                                                  \
+    size_t __el = (__last);                                                   \
+    if (__el > (__v).__n)                                                     \
+      __el = (__v).__n;                                                       \
+    if (__ef < __el)                                                          \
+    {                                                                         \
+      if ((__v).__on_free)                                                    \
+        for (size_t __x = __ef; __x < __el; ++__x)                            \
+          (__v).__on_free((__v).__data[__x]);                                 \
+      memmove((__v).__data + __ef, (__v).__data + __el,                       \
+              (__v).__t * ((__v).__n - __el));                                \
+      (__v).__n -= __el - __ef;                                               \
     }                                                                         \
   } while (0)
 
@@ -241,25 +423,169 @@
   do                                                                          \
   {                                                                           \
     size_t __p = (__pos);                                                     \
-    if (__p == 1)                                                             \
-      cvec_erase(__v, __p);                                                   \
-    else if (__p > 1 && (__v).__n > 0)                                        \
+    if (__p < (__v).__n)                                                      \
     {                                                                         \
       size_t __c = (__count);                                                 \
-      size_t __t = 0;                                                         \
-      size_t __x;                                                             \
-      for (__x = __p; __t < __c && __x < (__v).__n; ++__t, ++__x)             \
-        ;                                                                     \
+      if (__c > (__v).__n - __p)                                              \
+        __c = (__v).__n - __p;                                                \
+      cvec_erase_range(__v, __p, __p + __c);                                  \
+    }                                                                         \
+  } while (0)
+
+/*
+ * cvec_splice: Replace a range of items in a vector with other items.
+ *
+ * __v:         The vector.
+ * __pos:       The position of the first item to replace.
+ * __del_count: The number of items to remove starting at __pos.
+ * __src:       A pointer to the items to insert at __pos.
+ * __ins_count: The number of items in __src.
+ *
+ * The vector grows at most once and the tail is moved only once. A __pos
+ * beyond the end of the vector is treated as the end and __del_count is
+ * clipped to the items that exist. If __on_free is not null, then it is
+ * called on each removed item. Note that __src must not point into the
+ * vector itself.
+ */
+#define cvec_splice(__v, __pos, __del_count, __src, __ins_count)              \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    size_t __sp = (__pos);                                                    \
+    size_t __sd = (__del_count);                                              \
+    size_t __si = (__ins_count);                                              \
+    if (__sp > (__v).__n)                                                     \
+      __sp = (__v).__n;                                                       \
+    if (__sd > (__v).__n - __sp)                                              \
+      __sd = (__v).__n - __sp;                                                \
+    __cvec_grow_to(__v, (__v).__n - __sd + __si);                             \
+    if ((__v).__on_free)                                                      \
+      for (size_t __x = __sp; __x < __sp + __sd; ++__x)                       \
+        (__v).__on_free((__v).__data[__x]);                                   \
+    if (__sd != __si)                                                         \
+      memmove((__v).__data + __sp + __si, (__v).__data + __sp + __sd,         \
+              (__v).__t * ((__v).__n - __sp - __sd));                         \
+    if (__si)                                                                 \
+      memcpy((__v).__data + __sp, (__src), (__v).__t * __si);                 \
+    (__v).__n = (__v).__n - __sd + __si;                                      \
+  } while (0)
+
+/*
+ * cvec_swap_remove: Erase an item in a vector without preserving order.
+ *
+ * __v:   The vector.
+ * __pos: The position of the item to erase.
+ *
+ * The last item of the vector is moved into __pos, so this takes constant
+ * time regardless of the size of the vector.
+ */
+#define cvec_swap_remove(__v, __pos)                                          \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    if ((__v).__n > 0)                                                        \
+    {                                                                         \
+      size_t __p = (__pos);                                                   \
       if ((__v).__on_free)                                                    \
+        (__v).__on_free((__v).__data[__p]);                                   \
+      (__v).__data[__p] = (__v).__data[--(__v).__n];                          \
+    }                                                                         \
+  } while (0)
+
+/*
+ * Drops the items for which __pred is true, or false when __drop_if is 0,
+ * keeping the order of the rest.
+ */
+#define __cvec_compact(__v, __pred, __userdata, __drop_if)                    \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    size_t __w = 0;                                                           \
+    for (size_t __r = 0; __r < (__v).__n; ++__r)                              \
+    {                                                                         \
+      if (!(__pred((__v).__data[__r], (__userdata))) == !(__drop_if))         \
       {                                                                       \
-        size_t __stop = __p + __t;                                            \
-        for (__x = __p; __x < __stop; ++__x)                                  \
-          (__v).__on_free((__v).__data[__x]);                                 \
+        if ((__v).__on_free)                                                  \
+          (__v).__on_free((__v).__data[__r]);                                 \
+      }                                                                       \
+      else                                                                    \
+      {                                                                       \
+        if (__w != __r)                                                       \
+          (__v).__data[__w] = (__v).__data[__r];                              \
+        ++__w;                                                                \
+      }                                                                       \
+    }                                                                         \
+    (__v).__n = __w;                                                          \
+  } while (0)
+
+/*
+ * cvec_erase_if: Erase every item in a vector that matches a predicate.
+ *
+ * __v:        The vector.
+ * __pred:     A predicate function to be called on each item with the
+ *             following signature:
+ *                 int <func>(__T item, void *userdata);
+ *             Items for which it returns non-zero are erased.
+ * __userdata: Any userdata to be passed along to the predicate function.
+ *
+ * The remaining items keep their relative order and the vector is compacted
+ * in a single pass. If __on_free is not null, then it is called on each
+ * erased item.
+ */
+#define cvec_erase_if(__v, __pred, __userdata)                                \
+  __cvec_compact(__v, __pred, __userdata, 1)
+
+/*
+ * cvec_retain: Keep only the items in a vector that match a predicate.
+ *
+ * __v:        The vector.
+ * __pred:     A predicate function to be called on each item with the
+ *             following signature:
+ *                 int <func>(__T item, void *userdata);
+ *             Items for which it returns zero are erased.
+ * __userdata: Any userdata to be passed along to the predicate function.
+ *
+ * This is the inverse of cvec_erase_if.
+ */
+#define cvec_retain(__v, __pred, __userdata)                                  \
+  __cvec_compact(__v, __pred, __userdata, 0)
+
+/*
+ * cvec_erase_indices: Erase the items at a list of positions in a vector.
+ *
+ * __v:   The vector.
+ * __idx: A pointer to __k positions sorted in ascending order.
+ * __k:   The number of positions in __idx.
+ *
+ * The remaining items keep their relative order and the vector is compacted
+ * in a single pass. Duplicate and out of bounds positions are ignored. If
+ * __on_free is not null, then it is called on each erased item.
+ */
+#define cvec_erase_indices(__v, __idx, __k)                                   \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    const size_t *__ix = (__idx);                                             \
+    size_t __kx = (__k);                                                      \
+    size_t __j = 0;                                                           \
+    size_t __w = 0;                                                           \
+    for (size_t __r = 0; __r < (__v).__n; ++__r)                              \
+    {                                                                         \
+      while (__j < __kx && __ix[__j] < __r)                                   \
+        ++__j;                                                                \
+      if (__j < __kx && __ix[__j] == __r)                                     \
+      {                                                                       \
+        if ((__v).__on_free)                                                  \
+          (__v).__on_free((__v).__data[__r]);                                 \
+      }                                                                       \
+      else                                                                    \
+      {                                                                       \
+        if (__w != __r)                                                       \
+          (__v).__data[__w] = (__v).__data[__r];                              \
+        ++__w;                                                                \
       }                                                                       \
-      memcpy((__v).__data + __p, (__v).__data + (__p + __t),                  \
-             (__v).__t * ((__v).__n - (__p - __t)));                          \
-      (__v).__n -= __t;                                                       \
     }                                                                         \
+    (__v).__n = __w;                                                          \
   } while (0)
 
 /*
@@ -284,7 +610,8 @@
  * If the vector is empty, this will return the sentinel value provided during
  * initialization.
  */
-#define cvec_front(__v) ((__v).__n > 0) ? *cvec_begin(__v) : (__v).__sentinel
+#define cvec_front(__v)                                                       \
+  (((__v).__n > 0) ? *cvec_begin(__v) : (__v).__sentinel)
 
 /*
  * cvec_back: Returns the last item in a vector.
@@ -295,7 +622,7 @@
  * initialization.
  */
 #define cvec_back(__v)                                                        \
-  ((__v).__n > 0) ? *(cvec_end(__v) - 1) : (__v).__sentinel
+  (((__v).__n > 0) ? *(cvec_end(__v) - 1) : (__v).__sentinel)
 
 /*
  * cvec_push_front: Insert item at the beginning of a vector.
@@ -306,8 +633,9 @@
 #define cvec_push_front(__v, __item)                                          \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     __cvec_maybe_grow(__v);                                                   \
-    memcpy(cvec_begin(__v) + 1, (__v).__data, (__v).__t * (__v).__n++);       \
+    memmove(cvec_begin(__v) + 1, (__v).__data, (__v).__t * (__v).__n++);      \
     *(__v).__data = (__item);                                                 \
   } while (0)
 
@@ -320,6 +648,7 @@
 #define cvec_push_back(__v, __item)                                           \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     __cvec_maybe_grow(__v);                                                   \
     *((__v).__data + (__v).__n++) = (__item);                                 \
   } while (0)
@@ -341,11 +670,12 @@
 #define cvec_pop_front(__v)                                                   \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     if ((__v).__n > 0)                                                        \
     {                                                                         \
       if ((__v).__on_free)                                                    \
         (__v).__on_free(cvec_front(__v));                                     \
-      memcpy(cvec_begin(__v), cvec_begin(__v) + 1, (__v).__t * --(__v).__n);  \
+      memmove(cvec_begin(__v), cvec_begin(__v) + 1, (__v).__t * --(__v).__n); \
     }                                                                         \
   } while (0)
 
@@ -357,6 +687,7 @@
 #define cvec_pop_back(__v)                                                    \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     if ((__v).__n > 0)                                                        \
     {                                                                         \
       if ((__v).__on_free)                                                    \
@@ -386,6 +717,7 @@
 #define cvec_shrink_to_fit(__v)                                               \
   do                                                                          \
   {                                                                           \
+    __cvec_unshare(__v);                                                      \
     if ((__v).__m > (__v).__n)                                                \
     {                                                                         \
       (__v).__data = realloc((__v).__data, (__v).__t * (__v).__n);            \
@@ -395,6 +727,64 @@
     }                                                                         \
   } while (0)
 
+/*
+ * cvec_share: Make a vector share the buffer of another.
+ *
+ * __dst: The vector to make a copy in. It is freed first.
+ * __src: The vector to copy.
+ *
+ * This takes constant time: no items are copied, and both vectors hold a
+ * reference to the same buffer. Whichever of them is changed first by one
+ * of the macros in this header copies the buffer then, so neither sees the
+ * changes of the other. Writes through cvec_get or cvec_begin are not seen
+ * by those macros, so call cvec_unshare before writing that way.
+ *
+ * Only the buffer is copied, not what the items point to, so vectors with
+ * an __on_free function that releases their items should not be shared.
+ */
+#define cvec_share(__dst, __src)                                              \
+  do                                                                          \
+  {                                                                           \
+    cvec_free(__dst);                                                         \
+    if (!(__src).__rc)                                                        \
+    {                                                                         \
+      (__src).__rc = malloc(sizeof(*(__src).__rc));                           \
+      if (!(__src).__rc)                                                      \
+      {                                                                       \
+        (__dst).__e = CVEC_EOOM;                                              \
+        break;                                                                \
+      }                                                                       \
+      *(__src).__rc = 1;                                                      \
+    }                                                                         \
+    __cvec_rc_inc((__src).__rc);                                              \
+    (__dst).__n = (__src).__n;                                                \
+    (__dst).__m = (__src).__m;                                                \
+    (__dst).__t = (__src).__t;                                                \
+    (__dst).__data = (__src).__data;                                          \
+    (__dst).__on_free = (__src).__on_free;                                    \
+    (__dst).__sentinel = (__src).__sentinel;                                  \
+    (__dst).__rc = (__src).__rc;                                              \
+  } while (0)
+
+/*
+ * cvec_unshare: Give a vector a buffer of its own if it shares one.
+ *
+ * __v: The vector.
+ */
+#define cvec_unshare(__v)                                                     \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+  } while (0)
+
+/*
+ * cvec_is_shared: Returns whether or not a vector shares its buffer.
+ *
+ * __v: The vector.
+ */
+#define cvec_is_shared(__v)                                                   \
+  ((__v).__rc != NULL && __cvec_rc_get((__v).__rc) > 1)
+
 /*
  * cvec_empty: Returns whether or not the vector is empty.
  *
@@ -478,4 +868,3004 @@
 #define cvec_strerror(__v)                                                    \
   ((__v).__e == CVEC_EOOM) ? "Out of memory" : "No error"
 
+/*
+ * Reductions over vectors of float, double, int32_t and uint64_t (and int,
+ * where it is 32 bits wide). Each of these takes the item type as a plain
+ * token, the same way cvec_foreach does, and dispatches at runtime to an
+ * AVX-512 or AVX2 kernel when the CPU supports one. Define CVEC_NO_SIMD
+ * before including this header to always use the portable kernels.
+ *
+ * Note that results for floating point vectors containing NaN are
+ * unspecified, and that the order in which items are summed differs from a
+ * simple loop, so float sums may differ from one in the last few bits.
+ */
+
+#define CVEC_NPOS ((size_t) -1)
+
+/* Returns the number of trailing zero bits in a non-zero x */
+static inline unsigned
+__cvec_ctz(unsigned x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned) __builtin_ctz(x);
+#else
+  unsigned n = 0;
+  for (; !(x & 1); x >>= 1)
+    ++n;
+  return n;
+#endif
+}
+
+#if !defined(CVEC_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) &&    \
+    defined(__x86_64__)
+#define __CVEC_X86 1
+#include <immintrin.h>
+#define __cvec_target(__isa) __attribute__((target(__isa)))
+#define __cvec_has_avx2() __builtin_cpu_supports("avx2")
+#define __cvec_has_avx512() __builtin_cpu_supports("avx512f")
+#define __cvec_has_bmi2() __builtin_cpu_supports("bmi2")
+#endif
+
+/* Private macros used to instantiate the kernels below */
+#define __cvec_smin(__a, __b) ((__b) < (__a) ? (__b) : (__a))
+#define __cvec_smax(__a, __b) ((__a) < (__b) ? (__b) : (__a))
+#define __cvec_sadd(__a, __b) ((__a) + (__b))
+
+/*
+ * Portable kernels. They keep four independent accumulators so the
+ * compiler can overlap the dependency chains. All but sum require n > 0.
+ */
+#define __CVEC_DEFINE_SCALAR_FOLD(__name, __T, __S, __op, __init)             \
+  static inline __S __cvec_##__name##_scalar_##__T(const __T *p, size_t n)    \
+  {                                                                           \
+    __S a0 = __init, a1 = a0, a2 = a0, a3 = a0;                               \
+    size_t i = 0;                                                             \
+    for (; i + 4 <= n; i += 4)                                                \
+    {                                                                         \
+      a0 = __op(a0, (__S) p[i]);                                              \
+      a1 = __op(a1, (__S) p[i + 1]);                                          \
+      a2 = __op(a2, (__S) p[i + 2]);                                          \
+      a3 = __op(a3, (__S) p[i + 3]);                                          \
+    }                                                                         \
+    for (; i < n; ++i)                                                        \
+      a0 = __op(a0, (__S) p[i]);                                              \
+    return __op(__op(a0, a1), __op(a2, a3));                                  \
+  }
+
+#define __CVEC_DEFINE_SCALAR_REDUCE(__T, __S)                                 \
+  __CVEC_DEFINE_SCALAR_FOLD(sum, __T, __S, __cvec_sadd, 0)                    \
+  __CVEC_DEFINE_SCALAR_FOLD(min, __T, __T, __cvec_smin, p[0])                 \
+  __CVEC_DEFINE_SCALAR_FOLD(max, __T, __T, __cvec_smax, p[0])                 \
+  __CVEC_DEFINE_SCALAR_MINMAX(__T)
+
+#define __CVEC_DEFINE_SCALAR_MINMAX(__T)                                      \
+  static inline void __cvec_minmax_scalar_##__T(const __T *p, size_t n,       \
+                                                __T *lo, __T *hi)             \
+  {                                                                           \
+    __T l = p[0], h = p[0];                                                   \
+    for (size_t i = 1; i < n; ++i)                                            \
+    {                                                                         \
+      l = __cvec_smin(l, p[i]);                                               \
+      h = __cvec_smax(h, p[i]);                                               \
+    }                                                                         \
+    *lo = l;                                                                  \
+    *hi = h;                                                                  \
+  }
+
+__CVEC_DEFINE_SCALAR_REDUCE(float, float)
+__CVEC_DEFINE_SCALAR_REDUCE(double, double)
+__CVEC_DEFINE_SCALAR_REDUCE(int32_t, int64_t)
+__CVEC_DEFINE_SCALAR_REDUCE(uint64_t, uint64_t)
+
+#define __CVEC_DEFINE_SCALAR_KAHAN(__T)                                       \
+  static inline __T __cvec_sum_kahan_scalar_##__T(const __T *p, size_t n)     \
+  {                                                                           \
+    __T s = 0, c = 0;                                                         \
+    for (size_t i = 0; i < n; ++i)                                            \
+    {                                                                         \
+      __T y = p[i] - c;                                                       \
+      __T t = s + y;                                                          \
+      c = (t - s) - y;                                                        \
+      s = t;                                                                  \
+    }                                                                         \
+    return s;                                                                 \
+  }
+
+__CVEC_DEFINE_SCALAR_KAHAN(float)
+__CVEC_DEFINE_SCALAR_KAHAN(double)
+
+#ifdef __CVEC_X86
+/*
+ * Vector kernels. __W is the number of lanes in __V, and n must be at
+ * least __W. Lanes are combined by storing them and folding with the
+ * scalar operation.
+ */
+#define __CVEC_DEFINE_SIMD_FOLD(__isa, __tgt, __name, __T, __V, __W, __load,  \
+                                __store, __vop, __sop, __init)                \
+  __cvec_target(__tgt) static inline __T                                      \
+  __cvec_##__name##_##__isa##_##__T(const __T *p, size_t n)                   \
+  {                                                                           \
+    __V a0 = __load(p), a1 = __init, a2 = __init, a3 = __init;                \
+    __T lanes[__W];                                                           \
+    __T r;                                                                    \
+    size_t i = __W;                                                           \
+    for (; i + 4 * __W <= n; i += 4 * __W)                                    \
+    {                                                                         \
+      a0 = __vop(a0, __load(p + i));                                          \
+      a1 = __vop(a1, __load(p + i + __W));                                    \
+      a2 = __vop(a2, __load(p + i + 2 * __W));                                \
+      a3 = __vop(a3, __load(p + i + 3 * __W));                                \
+    }                                                                         \
+    for (; i + __W <= n; i += __W)                                            \
+      a0 = __vop(a0, __load(p + i));                                          \
+    a0 = __vop(__vop(a0, a1), __vop(a2, a3));                                 \
+    __store(lanes, a0);                                                       \
+    r = lanes[0];                                                             \
+    for (size_t j = 1; j < __W; ++j)                                          \
+      r = __sop(r, lanes[j]);                                                 \
+    for (; i < n; ++i)                                                        \
+      r = __sop(r, p[i]);                                                     \
+    return r;                                                                 \
+  }
+
+#define __CVEC_DEFINE_SIMD_MINMAX(__isa, __tgt, __T, __V, __W, __load,        \
+                                  __store, __vmin, __vmax)                    \
+  __cvec_target(__tgt) static inline void                                     \
+  __cvec_minmax_##__isa##_##__T(const __T *p, size_t n, __T *lo, __T *hi)     \
+  {                                                                           \
+    __V l0 = __load(p), l1 = l0, h0 = l0, h1 = l0;                            \
+    __T ll[__W], lh[__W];                                                     \
+    __T l, h;                                                                 \
+    size_t i = __W;                                                           \
+    for (; i + 2 * __W <= n; i += 2 * __W)                                    \
+    {                                                                         \
+      __V x0 = __load(p + i), x1 = __load(p + i + __W);                       \
+      l0 = __vmin(l0, x0);                                                    \
+      l1 = __vmin(l1, x1);                                                    \
+      h0 = __vmax(h0, x0);                                                    \
+      h1 = __vmax(h1, x1);                                                    \
+    }                                                                         \
+    for (; i + __W <= n; i += __W)                                            \
+    {                                                                         \
+      __V x0 = __load(p + i);                                                 \
+      l0 = __vmin(l0, x0);                                                    \
+      h0 = __vmax(h0, x0);                                                    \
+    }                                                                         \
+    __store(ll, __vmin(l0, l1));                                              \
+    __store(lh, __vmax(h0, h1));                                              \
+    l = ll[0];                                                                \
+    h = lh[0];                                                                \
+    for (size_t j = 1; j < __W; ++j)                                          \
+    {                                                                         \
+      l = __cvec_smin(l, ll[j]);                                              \
+      h = __cvec_smax(h, lh[j]);                                              \
+    }                                                                         \
+    for (; i < n; ++i)                                                        \
+    {                                                                         \
+      l = __cvec_smin(l, p[i]);                                               \
+      h = __cvec_smax(h, p[i]);                                               \
+    }                                                                         \
+    *lo = l;                                                                  \
+    *hi = h;                                                                  \
+  }
+
+#define __CVEC_DEFINE_SIMD_KAHAN(__isa, __tgt, __T, __V, __W, __load,         \
+                                 __store, __add, __sub, __zero)               \
+  __cvec_target(__tgt) static inline __T                                      \
+  __cvec_sum_kahan_##__isa##_##__T(const __T *p, size_t n)                    \
+  {                                                                           \
+    __V s = __zero, c = __zero;                                               \
+    __T ls[__W], lc[__W];                                                     \
+    __T rs = 0, rc = 0;                                                       \
+    size_t i = 0;                                                             \
+    for (; i + __W <= n; i += __W)                                            \
+    {                                                                         \
+      __V y = __sub(__load(p + i), c);                                        \
+      __V t = __add(s, y);                                                    \
+      c = __sub(__sub(t, s), y);                                              \
+      s = t;                                                                  \
+    }                                                                         \
+    __store(ls, s);                                                           \
+    __store(lc, c);                                                           \
+    for (size_t j = 0; j < __W; ++j)                                          \
+    {                                                                         \
+      __T y = (ls[j] - lc[j]) - rc;                                           \
+      __T t = rs + y;                                                         \
+      rc = (t - rs) - y;                                                      \
+      rs = t;                                                                 \
+    }                                                                         \
+    for (; i < n; ++i)                                                        \
+    {                                                                         \
+      __T y = p[i] - rc;                                                      \
+      __T t = rs + y;                                                         \
+      rc = (t - rs) - y;                                                      \
+      rs = t;                                                                 \
+    }                                                                         \
+    return rs;                                                                \
+  }
+
+#define __cvec_ld256i(__p) _mm256_loadu_si256((const __m256i *) (__p))
+#define __cvec_st256i(__p, __x) _mm256_storeu_si256((__m256i *) (__p), __x)
+#define __cvec_ld512i(__p) _mm512_loadu_si512((const void *) (__p))
+#define __cvec_st512i(__p, __x) _mm512_storeu_si512((void *) (__p), __x)
+
+/* AVX2 has no unsigned 64-bit compare, so flip the sign bits first */
+__cvec_target("avx2") static inline __m256i
+__cvec_avx2_gt_epu64(__m256i a, __m256i b)
+{
+  const __m256i bias = _mm256_set1_epi64x((long long) 0x8000000000000000ULL);
+  return _mm256_cmpgt_epi64(_mm256_xor_si256(a, bias),
+                            _mm256_xor_si256(b, bias));
+}
+
+__cvec_target("avx2") static inline __m256i
+__cvec_avx2_min_epu64(__m256i a, __m256i b)
+{
+  return _mm256_blendv_epi8(a, b, __cvec_avx2_gt_epu64(a, b));
+}
+
+__cvec_target("avx2") static inline __m256i
+__cvec_avx2_max_epu64(__m256i a, __m256i b)
+{
+  return _mm256_blendv_epi8(b, a, __cvec_avx2_gt_epu64(a, b));
+}
+
+#define __CVEC_DEFINE_SIMD_REDUCE(__isa, __tgt, __T, __V, __W, __load,        \
+                                  __store, __vmin, __vmax)                    \
+  __CVEC_DEFINE_SIMD_FOLD(__isa, __tgt, min, __T, __V, __W, __load, __store,  \
+                          __vmin, __cvec_smin, a0)                            \
+  __CVEC_DEFINE_SIMD_FOLD(__isa, __tgt, max, __T, __V, __W, __load, __store,  \
+                          __vmax, __cvec_smax, a0)                            \
+  __CVEC_DEFINE_SIMD_MINMAX(__isa, __tgt, __T, __V, __W, __load, __store,     \
+                            __vmin, __vmax)
+
+__CVEC_DEFINE_SIMD_REDUCE(avx2, "avx2", float, __m256, 8, _mm256_loadu_ps,
+                          _mm256_storeu_ps, _mm256_min_ps, _mm256_max_ps)
+__CVEC_DEFINE_SIMD_REDUCE(avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd,
+                          _mm256_storeu_pd, _mm256_min_pd, _mm256_max_pd)
+__CVEC_DEFINE_SIMD_REDUCE(avx2, "avx2", int32_t, __m256i, 8, __cvec_ld256i,
+                          __cvec_st256i, _mm256_min_epi32, _mm256_max_epi32)
+__CVEC_DEFINE_SIMD_REDUCE(avx2, "avx2", uint64_t, __m256i, 4, __cvec_ld256i,
+                          __cvec_st256i, __cvec_avx2_min_epu64,
+                          __cvec_avx2_max_epu64)
+__CVEC_DEFINE_SIMD_REDUCE(avx512, "avx512f", float, __m512, 16,
+                          _mm512_loadu_ps, _mm512_storeu_ps, _mm512_min_ps,
+                          _mm512_max_ps)
+__CVEC_DEFINE_SIMD_REDUCE(avx512, "avx512f", double, __m512d, 8,
+                          _mm512_loadu_pd, _mm512_storeu_pd, _mm512_min_pd,
+                          _mm512_max_pd)
+__CVEC_DEFINE_SIMD_REDUCE(avx512, "avx512f", int32_t, __m512i, 16,
+                          __cvec_ld512i, __cvec_st512i, _mm512_min_epi32,
+                          _mm512_max_epi32)
+__CVEC_DEFINE_SIMD_REDUCE(avx512, "avx512f", uint64_t, __m512i, 8,
+                          __cvec_ld512i, __cvec_st512i, _mm512_min_epu64,
+                          _mm512_max_epu64)
+
+__CVEC_DEFINE_SIMD_FOLD(avx2, "avx2", sum, float, __m256, 8, _mm256_loadu_ps,
+                        _mm256_storeu_ps, _mm256_add_ps, __cvec_sadd,
+                        _mm256_setzero_ps())
+__CVEC_DEFINE_SIMD_FOLD(avx2, "avx2", sum, double, __m256d, 4,
+                        _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd,
+                        __cvec_sadd, _mm256_setzero_pd())
+__CVEC_DEFINE_SIMD_FOLD(avx2, "avx2", sum, uint64_t, __m256i, 4,
+                        __cvec_ld256i, __cvec_st256i, _mm256_add_epi64,
+                        __cvec_sadd, _mm256_setzero_si256())
+__CVEC_DEFINE_SIMD_FOLD(avx512, "avx512f", sum, float, __m512, 16,
+                        _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps,
+                        __cvec_sadd, _mm512_setzero_ps())
+__CVEC_DEFINE_SIMD_FOLD(avx512, "avx512f", sum, double, __m512d, 8,
+                        _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd,
+                        __cvec_sadd, _mm512_setzero_pd())
+__CVEC_DEFINE_SIMD_FOLD(avx512, "avx512f", sum, uint64_t, __m512i, 8,
+                        __cvec_ld512i, __cvec_st512i, _mm512_add_epi64,
+                        __cvec_sadd, _mm512_setzero_si512())
+
+__CVEC_DEFINE_SIMD_KAHAN(avx2, "avx2", float, __m256, 8, _mm256_loadu_ps,
+                         _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps,
+                         _mm256_setzero_ps())
+__CVEC_DEFINE_SIMD_KAHAN(avx2, "avx2", double, __m256d, 4, _mm256_loadu_pd,
+                         _mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd,
+                         _mm256_setzero_pd())
+__CVEC_DEFINE_SIMD_KAHAN(avx512, "avx512f", float, __m512, 16,
+                         _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps,
+                         _mm512_sub_ps, _mm512_setzero_ps())
+__CVEC_DEFINE_SIMD_KAHAN(avx512, "avx512f", double, __m512d, 8,
+                         _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd,
+                         _mm512_sub_pd, _mm512_setzero_pd())
+
+/* int32_t sums are widened to 64 bits so they cannot overflow */
+__cvec_target("avx2") static inline int64_t
+__cvec_sum_avx2_int32_t(const int32_t *p, size_t n)
+{
+  __m256i s0 = _mm256_setzero_si256(), s1 = s0;
+  int64_t lanes[4];
+  int64_t r = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i x = __cvec_ld256i(p + i);
+    s0 = _mm256_add_epi64(s0, _mm256_cvtepi32_epi64(
+                                  _mm256_castsi256_si128(x)));
+    s1 = _mm256_add_epi64(s1, _mm256_cvtepi32_epi64(
+                                  _mm256_extracti128_si256(x, 1)));
+  }
+  __cvec_st256i(lanes, _mm256_add_epi64(s0, s1));
+  for (size_t j = 0; j < 4; ++j)
+    r += lanes[j];
+  for (; i < n; ++i)
+    r += p[i];
+  return r;
+}
+
+__cvec_target("avx512f") static inline int64_t
+__cvec_sum_avx512_int32_t(const int32_t *p, size_t n)
+{
+  __m512i s0 = _mm512_setzero_si512(), s1 = s0;
+  int64_t r;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    __m512i x = __cvec_ld512i(p + i);
+    s0 = _mm512_add_epi64(s0, _mm512_cvtepi32_epi64(
+                                  _mm512_castsi512_si256(x)));
+    s1 = _mm512_add_epi64(s1, _mm512_cvtepi32_epi64(
+                                  _mm512_extracti64x4_epi64(x, 1)));
+  }
+  r = _mm512_reduce_add_epi64(_mm512_add_epi64(s0, s1));
+  for (; i < n; ++i)
+    r += p[i];
+  return r;
+}
+
+/* Inputs shorter than this are not worth the dispatch */
+#define __CVEC_SIMD_MIN 64
+
+#define __cvec_simd_pick(__name, __T, __n)                                    \
+  ((__n) < __CVEC_SIMD_MIN ? NULL                                             \
+   : __cvec_has_avx512()   ? __cvec_##__name##_avx512_##__T                   \
+   : __cvec_has_avx2()     ? __cvec_##__name##_avx2_##__T                     \
+                           : NULL)
+#else
+#define __cvec_simd_pick(__name, __T, __n) NULL
+#endif /* __CVEC_X86 */
+
+#define __CVEC_DEFINE_REDUCE(__name, __T, __S)                                \
+  static inline __S __cvec_##__name##_##__T(const __T *p, size_t n)           \
+  {                                                                           \
+    __S (*k)(const __T *, size_t) = __cvec_simd_pick(__name, __T, n);         \
+    return k ? k(p, n) : __cvec_##__name##_scalar_##__T(p, n);                \
+  }
+
+#define __CVEC_DEFINE_ARG(__name, __T, __cmp)                                 \
+  static inline size_t __cvec_arg##__name##_##__T(const __T *p, size_t n)     \
+  {                                                                           \
+    size_t blk = 0;                                                           \
+    size_t len = n < 1024 ? n : 1024;                                         \
+    __T best = __cvec_##__name##_##__T(p, len);                               \
+    for (size_t b = len; b < n; b += 1024)                                    \
+    {                                                                         \
+      size_t l = n - b < 1024 ? n - b : 1024;                                 \
+      __T m = __cvec_##__name##_##__T(p + b, l);                              \
+      if (m __cmp best)                                                       \
+      {                                                                       \
+        best = m;                                                             \
+        blk = b;                                                              \
+      }                                                                       \
+    }                                                                         \
+    while (blk < n - 1 && !(p[blk] == best))                                  \
+      ++blk;                                                                  \
+    return blk;                                                               \
+  }
+
+#define __CVEC_DEFINE_REDUCE_ALL(__T, __S)                                    \
+  __CVEC_DEFINE_REDUCE(sum, __T, __S)                                         \
+  __CVEC_DEFINE_REDUCE(min, __T, __T)                                         \
+  __CVEC_DEFINE_REDUCE(max, __T, __T)                                         \
+  __CVEC_DEFINE_ARG(min, __T, <)                                              \
+  __CVEC_DEFINE_ARG(max, __T, >)                                              \
+  static inline void __cvec_minmax_##__T(const __T *p, size_t n, __T *lo,     \
+                                         __T *hi)                             \
+  {                                                                           \
+    void (*k)(const __T *, size_t, __T *, __T *) =                            \
+        __cvec_simd_pick(minmax, __T, n);                                     \
+    if (k)                                                                    \
+      k(p, n, lo, hi);                                                        \
+    else                                                                      \
+      __cvec_minmax_scalar_##__T(p, n, lo, hi);                               \
+  }
+
+__CVEC_DEFINE_REDUCE_ALL(float, float)
+__CVEC_DEFINE_REDUCE_ALL(double, double)
+__CVEC_DEFINE_REDUCE_ALL(int32_t, int64_t)
+__CVEC_DEFINE_REDUCE_ALL(uint64_t, uint64_t)
+__CVEC_DEFINE_REDUCE(sum_kahan, float, float)
+__CVEC_DEFINE_REDUCE(sum_kahan, double, double)
+
+/* Below this many items a pairwise sum just uses the blocked kernel */
+#define __CVEC_PAIRWISE_BLOCK 256
+
+#define __CVEC_DEFINE_PAIRWISE(__T)                                           \
+  static inline __T __cvec_sum_pairwise_##__T(const __T *p, size_t n)         \
+  {                                                                           \
+    if (n <= __CVEC_PAIRWISE_BLOCK)                                           \
+      return __cvec_sum_##__T(p, n);                                          \
+    return __cvec_sum_pairwise_##__T(p, n / 2) +                              \
+           __cvec_sum_pairwise_##__T(p + n / 2, n - n / 2);                   \
+  }
+
+__CVEC_DEFINE_PAIRWISE(float)
+__CVEC_DEFINE_PAIRWISE(double)
+
+#if INT_MAX == INT32_MAX
+#define __cvec_sum_int(__p, __n)                                              \
+  __cvec_sum_int32_t((const int32_t *) (__p), __n)
+#define __cvec_min_int(__p, __n)                                              \
+  __cvec_min_int32_t((const int32_t *) (__p), __n)
+#define __cvec_max_int(__p, __n)                                              \
+  __cvec_max_int32_t((const int32_t *) (__p), __n)
+#define __cvec_argmin_int(__p, __n)                                           \
+  __cvec_argmin_int32_t((const int32_t *) (__p), __n)
+#define __cvec_argmax_int(__p, __n)                                           \
+  __cvec_argmax_int32_t((const int32_t *) (__p), __n)
+#define __cvec_minmax_int(__p, __n, __lo, __hi)                               \
+  __cvec_minmax_int32_t((const int32_t *) (__p), __n, (int32_t *) (__lo),     \
+                        (int32_t *) (__hi))
+#endif
+
+/*
+ * cvec_sum: Returns the sum of all the items in a vector.
+ *
+ * __v: The vector.
+ * __T: The type of the items contained in the vector.
+ *
+ * Sums of int32_t vectors are returned as int64_t. An empty vector sums to
+ * zero.
+ */
+#define cvec_sum(__v, __T) __cvec_sum_##__T(cvec_begin(__v), (__v).__n)
+
+/*
+ * cvec_sum_kahan: Returns the compensated sum of a float or double vector.
+ *
+ * __v: The vector.
+ * __T: The type of the items contained in the vector.
+ *
+ * This is slower than cvec_sum but keeps the rounding error independent of
+ * the size of the vector. It has no effect when compiled with -ffast-math.
+ */
+#define cvec_sum_kahan(__v, __T)                                              \
+  __cvec_sum_kahan_##__T(cvec_begin(__v), (__v).__n)
+
+/*
+ * cvec_sum_pairwise: Returns the pairwise sum of a float or double vector.
+ *
+ * __v: The vector.
+ * __T: The type of the items contained in the vector.
+ *
+ * The rounding error grows with the logarithm of the size of the vector, at
+ * almost the same speed as cvec_sum.
+ */
+#define cvec_sum_pairwise(__v, __T)                                           \
+  __cvec_sum_pairwise_##__T(cvec_begin(__v), (__v).__n)
+
+/*
+ * cvec_min: Returns the smallest item in a vector.
+ *
+ * __v: The vector.
+ * __T: The type of the items contained in the vector.
+ *
+ * If the vector is empty, this will return the sentinel value provided during
+ * initialization.
+ */
+#define cvec_min(__v, __T)                                                    \
+  (((__v).__n > 0) ? __cvec_min_##__T(cvec_begin(__v), (__v).__n)             \
+                   : (__v).__sentinel)
+
+/*
+ * cvec_max: Returns the largest item in a vector.
+ *
+ * __v: The vector.
+ * __T: The type of the items contained in the vector.
+ *
+ * If the vector is empty, this will return the sentinel value provided during
+ * initialization.
+ */
+#define cvec_max(__v, __T)                                                    \
+  (((__v).__n > 0) ? __cvec_max_##__T(cvec_begin(__v), (__v).__n)             \
+                   : (__v).__sentinel)
+
+/*
+ * cvec_minmax: Stores the smallest and largest items in a vector.
+ *
+ * __v:   The vector.
+ * __T:   The type of the items contained in the vector.
+ * __min: A variable of type __T to store the smallest item in.
+ * __max: A variable of type __T to store the largest item in.
+ *
+ * If the vector is empty, both are set to the sentinel value provided during
+ * initialization.
+ */
+#define cvec_minmax(__v, __T, __min, __max)                                   \
+  do                                                                          \
+  {                                                                           \
+    if ((__v).__n > 0)                                                        \
+      __cvec_minmax_##__T(cvec_begin(__v), (__v).__n, &(__min), &(__max));    \
+    else                                                                      \
+      (__min) = (__max) = (__v).__sentinel;                                   \
+  } while (0)
+
+/*
+ * cvec_argmin: Returns the position of the smallest item in a vector.
+ *
+ * __v: The vector.
+ * __T: The type of the items contained in the vector.
+ *
+ * If the smallest item occurs more than once, the first position is
+ * returned. If the vector is empty, this will return CVEC_NPOS.
+ */
+#define cvec_argmin(__v, __T)                                                 \
+  (((__v).__n > 0) ? __cvec_argmin_##__T(cvec_begin(__v), (__v).__n)          \
+                   : CVEC_NPOS)
+
+/*
+ * cvec_argmax: Returns the position of the largest item in a vector.
+ *
+ * __v: The vector.
+ * __T: The type of the items contained in the vector.
+ *
+ * If the largest item occurs more than once, the first position is
+ * returned. If the vector is empty, this will return CVEC_NPOS.
+ */
+#define cvec_argmax(__v, __T)                                                 \
+  (((__v).__n > 0) ? __cvec_argmax_##__T(cvec_begin(__v), (__v).__n)          \
+                   : CVEC_NPOS)
+
+/*
+ * Comparison operators used by cvec_filter_cmp, cvec_select_cmp and
+ * cvec_mask_cmp. Each item is compared against a constant as in
+ * "item <op> value".
+ */
+#define CVEC_LT 0
+#define CVEC_LE 1
+#define CVEC_GT 2
+#define CVEC_GE 3
+#define CVEC_EQ 4
+#define CVEC_NE 5
+
+/* A private macro that compares two scalars with one of the operators */
+#define __cvec_cmp(__a, __op, __b)                                            \
+  ((__op) == CVEC_LT   ? (__a) < (__b)                                        \
+   : (__op) == CVEC_LE ? (__a) <= (__b)                                       \
+   : (__op) == CVEC_GT ? (__a) > (__b)                                        \
+   : (__op) == CVEC_GE ? (__a) >= (__b)                                       \
+   : (__op) == CVEC_EQ ? (__a) == (__b)                                       \
+                       : (__a) != (__b))
+
+/*
+ * The vector kernels store whole registers past the last selected item, so
+ * filter destinations get this many items of spare capacity.
+ */
+#define __CVEC_FILTER_SLACK 16
+
+/*
+ * Portable kernels. They write every item and only advance the output
+ * position on a match, which avoids a branch per item.
+ */
+#define __CVEC_DEFINE_SCALAR_FILTER(__T)                                      \
+  static inline size_t __cvec_filter_scalar_##__T(                            \
+      const __T *p, size_t n, int op, __T value, __T *out)                    \
+  {                                                                           \
+    size_t k = 0;                                                             \
+    for (size_t i = 0; i < n; ++i)                                            \
+    {                                                                         \
+      out[k] = p[i];                                                          \
+      k += __cvec_cmp(p[i], op, value);                                       \
+    }                                                                         \
+    return k;                                                                 \
+  }                                                                           \
+  static inline size_t __cvec_select_scalar_##__T(                            \
+      const __T *p, size_t n, int op, __T value, size_t *out)                 \
+  {                                                                           \
+    size_t k = 0;                                                             \
+    for (size_t i = 0; i < n; ++i)                                            \
+    {                                                                         \
+      out[k] = i;                                                             \
+      k += __cvec_cmp(p[i], op, value);                                       \
+    }                                                                         \
+    return k;                                                                 \
+  }                                                                           \
+  static inline size_t __cvec_mask_scalar_##__T(                              \
+      const __T *p, size_t n, int op, __T value, uint64_t *out)               \
+  {                                                                           \
+    for (size_t i = 0; i < n; i += 64)                                        \
+    {                                                                         \
+      uint64_t w = 0;                                                         \
+      size_t l = n - i < 64 ? n - i : 64;                                     \
+      for (size_t j = 0; j < l; ++j)                                          \
+        w |= (uint64_t) __cvec_cmp(p[i + j], op, value) << j;                 \
+      out[i / 64] = w;                                                        \
+    }                                                                         \
+    return (n + 63) / 64;                                                     \
+  }
+
+__CVEC_DEFINE_SCALAR_FILTER(float)
+__CVEC_DEFINE_SCALAR_FILTER(double)
+__CVEC_DEFINE_SCALAR_FILTER(int32_t)
+__CVEC_DEFINE_SCALAR_FILTER(uint64_t)
+
+#ifdef __CVEC_X86
+/*
+ * Compare __W items at p against a broadcast constant and return one bit
+ * per item.
+ */
+__cvec_target("avx2") static inline unsigned
+__cvec_cmpmask_avx2_float(const float *p, __m256 c, int op)
+{
+  __m256 x = _mm256_loadu_ps(p);
+  switch (op)
+  {
+  case CVEC_LT:
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, c, _CMP_LT_OQ));
+  case CVEC_LE:
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, c, _CMP_LE_OQ));
+  case CVEC_GT:
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, c, _CMP_GT_OQ));
+  case CVEC_GE:
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, c, _CMP_GE_OQ));
+  case CVEC_EQ:
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, c, _CMP_EQ_OQ));
+  default:
+    return _mm256_movemask_ps(_mm256_cmp_ps(x, c, _CMP_NEQ_UQ));
+  }
+}
+
+__cvec_target("avx2") static inline unsigned
+__cvec_cmpmask_avx2_double(const double *p, __m256d c, int op)
+{
+  __m256d x = _mm256_loadu_pd(p);
+  switch (op)
+  {
+  case CVEC_LT:
+    return _mm256_movemask_pd(_mm256_cmp_pd(x, c, _CMP_LT_OQ));
+  case CVEC_LE:
+    return _mm256_movemask_pd(_mm256_cmp_pd(x, c, _CMP_LE_OQ));
+  case CVEC_GT:
+    return _mm256_movemask_pd(_mm256_cmp_pd(x, c, _CMP_GT_OQ));
+  case CVEC_GE:
+    return _mm256_movemask_pd(_mm256_cmp_pd(x, c, _CMP_GE_OQ));
+  case CVEC_EQ:
+    return _mm256_movemask_pd(_mm256_cmp_pd(x, c, _CMP_EQ_OQ));
+  default:
+    return _mm256_movemask_pd(_mm256_cmp_pd(x, c, _CMP_NEQ_UQ));
+  }
+}
+
+/*
+ * AVX2 only has "greater than" and "equal" for integers, so the other
+ * operators are built from those and inverted where needed.
+ */
+__cvec_target("avx2") static inline unsigned
+__cvec_cmpmask_avx2_int32_t(const int32_t *p, __m256i c, int op)
+{
+  __m256i x = __cvec_ld256i(p);
+  __m256i r;
+  unsigned m;
+  switch (op)
+  {
+  case CVEC_LT:
+  case CVEC_GE:
+    r = _mm256_cmpgt_epi32(c, x);
+    break;
+  case CVEC_GT:
+  case CVEC_LE:
+    r = _mm256_cmpgt_epi32(x, c);
+    break;
+  default:
+    r = _mm256_cmpeq_epi32(x, c);
+    break;
+  }
+  m = _mm256_movemask_ps(_mm256_castsi256_ps(r));
+  return (op == CVEC_GE || op == CVEC_LE || op == CVEC_NE) ? ~m & 0xff : m;
+}
+
+__cvec_target("avx2") static inline unsigned
+__cvec_cmpmask_avx2_uint64_t(const uint64_t *p, __m256i c, int op)
+{
+  __m256i x = __cvec_ld256i(p);
+  __m256i r;
+  unsigned m;
+  switch (op)
+  {
+  case CVEC_LT:
+  case CVEC_GE:
+    r = __cvec_avx2_gt_epu64(c, x);
+    break;
+  case CVEC_GT:
+  case CVEC_LE:
+    r = __cvec_avx2_gt_epu64(x, c);
+    break;
+  default:
+    r = _mm256_cmpeq_epi64(x, c);
+    break;
+  }
+  m = _mm256_movemask_pd(_mm256_castsi256_pd(r));
+  return (op == CVEC_GE || op == CVEC_LE || op == CVEC_NE) ? ~m & 0xf : m;
+}
+
+/*
+ * Move the 32-bit lanes of x selected by m to the front of the register
+ * and store all of it at out. The permutation is derived from the mask
+ * with PDEP/PEXT instead of a lookup table.
+ */
+__cvec_target("avx2,bmi2") static inline void
+__cvec_compact_avx2(void *out, __m256i x, unsigned m)
+{
+  uint64_t spread = _pdep_u64(m, 0x0101010101010101ULL) * 0xff;
+  uint64_t idx = _pext_u64(0x0706050403020100ULL, spread);
+  __m256i perm = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128((long long) idx));
+  _mm256_storeu_si256((__m256i *) out, _mm256_permutevar8x32_epi32(x, perm));
+}
+
+/* 64-bit lanes are moved as pairs of 32-bit lanes */
+#define __cvec_compact32_avx2(__out, __x, __m)                                \
+  __cvec_compact_avx2(__out, __x, __m)
+#define __cvec_compact64_avx2(__out, __x, __m)                                \
+  __cvec_compact_avx2(__out, __x, _pdep_u32(__m, 0x55) * 3)
+
+#define __CVEC_DEFINE_AVX2_FILTER(__T, __V, __W, __set1, __cast, __compact)   \
+  __cvec_target("avx2,bmi2") static inline size_t                             \
+  __cvec_filter_avx2_##__T(const __T *p, size_t n, int op, __T value,         \
+                           __T *out)                                          \
+  {                                                                           \
+    __V c = __set1(value);                                                    \
+    size_t i = 0, k = 0;                                                      \
+    for (; i + __W <= n; i += __W)                                            \
+    {                                                                         \
+      unsigned m = __cvec_cmpmask_avx2_##__T(p + i, c, op);                   \
+      __compact(out + k, __cast(p + i), m);                                   \
+      k += __builtin_popcount(m);                                             \
+    }                                                                         \
+    return k + __cvec_filter_scalar_##__T(p + i, n - i, op, value, out + k);  \
+  }                                                                           \
+  __cvec_target("avx2,bmi2") static inline size_t                             \
+  __cvec_select_avx2_##__T(const __T *p, size_t n, int op, __T value,         \
+                           size_t *out)                                       \
+  {                                                                           \
+    __V c = __set1(value);                                                    \
+    size_t i = 0, k = 0;                                                      \
+    for (; i + __W <= n; i += __W)                                            \
+      for (unsigned m = __cvec_cmpmask_avx2_##__T(p + i, c, op); m;           \
+           m &= m - 1)                                                        \
+        out[k++] = i + __builtin_ctz(m);                                      \
+    for (; i < n; ++i)                                                        \
+    {                                                                         \
+      out[k] = i;                                                             \
+      k += __cvec_cmp(p[i], op, value);                                       \
+    }                                                                         \
+    return k;                                                                 \
+  }                                                                           \
+  __cvec_target("avx2,bmi2") static inline size_t                             \
+  __cvec_mask_avx2_##__T(const __T *p, size_t n, int op, __T value,           \
+                         uint64_t *out)                                       \
+  {                                                                           \
+    __V c = __set1(value);                                                    \
+    size_t i = 0;                                                             \
+    for (; i + 64 <= n; i += 64)                                              \
+    {                                                                         \
+      uint64_t w = 0;                                                         \
+      for (size_t j = 0; j < 64; j += __W)                                    \
+        w |= (uint64_t) __cvec_cmpmask_avx2_##__T(p + i + j, c, op) << j;     \
+      out[i / 64] = w;                                                        \
+    }                                                                         \
+    __cvec_mask_scalar_##__T(p + i, n - i, op, value, out + i / 64);          \
+    return (n + 63) / 64;                                                     \
+  }
+
+#define __cvec_set1_epi32(__x) _mm256_set1_epi32(__x)
+#define __cvec_set1_epi64(__x) _mm256_set1_epi64x((long long) (__x))
+
+__CVEC_DEFINE_AVX2_FILTER(float, __m256, 8, _mm256_set1_ps, __cvec_ld256i,
+                          __cvec_compact32_avx2)
+__CVEC_DEFINE_AVX2_FILTER(double, __m256d, 4, _mm256_set1_pd, __cvec_ld256i,
+                          __cvec_compact64_avx2)
+__CVEC_DEFINE_AVX2_FILTER(int32_t, __m256i, 8, __cvec_set1_epi32,
+                          __cvec_ld256i, __cvec_compact32_avx2)
+__CVEC_DEFINE_AVX2_FILTER(uint64_t, __m256i, 4, __cvec_set1_epi64,
+                          __cvec_ld256i, __cvec_compact64_avx2)
+
+/*
+ * AVX-512 compares straight into mask registers and has native compress
+ * stores, so its kernels need no permutation.
+ */
+#define __CVEC_DEFINE_AVX512_CMPMASK(__T, __V, __cmp, __lt, __le, __gt, __ge, \
+                                     __eq, __ne)                              \
+  __cvec_target("avx512f") static inline unsigned                             \
+  __cvec_cmpmask_avx512_##__T(__V x, __V c, int op)                           \
+  {                                                                           \
+    switch (op)                                                               \
+    {                                                                         \
+    case CVEC_LT:                                                             \
+      return __cmp(x, c, __lt);                                               \
+    case CVEC_LE:                                                             \
+      return __cmp(x, c, __le);                                               \
+    case CVEC_GT:                                                             \
+      return __cmp(x, c, __gt);                                               \
+    case CVEC_GE:                                                             \
+      return __cmp(x, c, __ge);                                               \
+    case CVEC_EQ:                                                             \
+      return __cmp(x, c, __eq);                                               \
+    default:                                                                  \
+      return __cmp(x, c, __ne);                                               \
+    }                                                                         \
+  }
+
+__CVEC_DEFINE_AVX512_CMPMASK(float, __m512, _mm512_cmp_ps_mask, _CMP_LT_OQ,
+                             _CMP_LE_OQ, _CMP_GT_OQ, _CMP_GE_OQ, _CMP_EQ_OQ,
+                             _CMP_NEQ_UQ)
+__CVEC_DEFINE_AVX512_CMPMASK(double, __m512d, _mm512_cmp_pd_mask, _CMP_LT_OQ,
+                             _CMP_LE_OQ, _CMP_GT_OQ, _CMP_GE_OQ, _CMP_EQ_OQ,
+                             _CMP_NEQ_UQ)
+__CVEC_DEFINE_AVX512_CMPMASK(int32_t, __m512i, _mm512_cmp_epi32_mask,
+                             _MM_CMPINT_LT, _MM_CMPINT_LE, _MM_CMPINT_NLE,
+                             _MM_CMPINT_NLT, _MM_CMPINT_EQ, _MM_CMPINT_NE)
+__CVEC_DEFINE_AVX512_CMPMASK(uint64_t, __m512i, _mm512_cmp_epu64_mask,
+                             _MM_CMPINT_LT, _MM_CMPINT_LE, _MM_CMPINT_NLE,
+                             _MM_CMPINT_NLT, _MM_CMPINT_EQ, _MM_CMPINT_NE)
+
+#define __CVEC_DEFINE_AVX512_FILTER(__T, __V, __W, __load, __set1, __store)   \
+  __cvec_target("avx512f") static inline size_t                               \
+  __cvec_filter_avx512_##__T(const __T *p, size_t n, int op, __T value,       \
+                             __T *out)                                        \
+  {                                                                           \
+    __V c = __set1(value);                                                    \
+    size_t i = 0, k = 0;                                                      \
+    for (; i + __W <= n; i += __W)                                            \
+    {                                                                         \
+      __V x = __load(p + i);                                                  \
+      unsigned m = __cvec_cmpmask_avx512_##__T(x, c, op);                     \
+      __store(out + k, m, x);                                                 \
+      k += __builtin_popcount(m);                                             \
+    }                                                                         \
+    return k + __cvec_filter_scalar_##__T(p + i, n - i, op, value, out + k);  \
+  }                                                                           \
+  __cvec_target("avx512f") static inline size_t                               \
+  __cvec_select_avx512_##__T(const __T *p, size_t n, int op, __T value,       \
+                             size_t *out)                                     \
+  {                                                                           \
+    __V c = __set1(value);                                                    \
+    size_t i = 0, k = 0;                                                      \
+    for (; i + __W <= n; i += __W)                                            \
+      for (unsigned m = __cvec_cmpmask_avx512_##__T(__load(p + i), c, op); m; \
+           m &= m - 1)                                                        \
+        out[k++] = i + __builtin_ctz(m);                                      \
+    for (; i < n; ++i)                                                        \
+    {                                                                         \
+      out[k] = i;                                                             \
+      k += __cvec_cmp(p[i], op, value);                                       \
+    }                                                                         \
+    return k;                                                                 \
+  }                                                                           \
+  __cvec_target("avx512f") static inline size_t                               \
+  __cvec_mask_avx512_##__T(const __T *p, size_t n, int op, __T value,         \
+                           uint64_t *out)                                     \
+  {                                                                           \
+    __V c = __set1(value);                                                    \
+    size_t i = 0;                                                             \
+    for (; i + 64 <= n; i += 64)                                              \
+    {                                                                         \
+      uint64_t w = 0;                                                         \
+      for (size_t j = 0; j < 64; j += __W)                                    \
+        w |= (uint64_t) __cvec_cmpmask_avx512_##__T(__load(p + i + j), c, op) \
+             << j;                                                            \
+      out[i / 64] = w;                                                        \
+    }                                                                         \
+    __cvec_mask_scalar_##__T(p + i, n - i, op, value, out + i / 64);          \
+    return (n + 63) / 64;                                                     \
+  }
+
+#define __cvec_set1_512epi64(__x) _mm512_set1_epi64((long long) (__x))
+
+__CVEC_DEFINE_AVX512_FILTER(float, __m512, 16, _mm512_loadu_ps,
+                            _mm512_set1_ps, _mm512_mask_compressstoreu_ps)
+__CVEC_DEFINE_AVX512_FILTER(double, __m512d, 8, _mm512_loadu_pd,
+                            _mm512_set1_pd, _mm512_mask_compressstoreu_pd)
+__CVEC_DEFINE_AVX512_FILTER(int32_t, __m512i, 16, __cvec_ld512i,
+                            _mm512_set1_epi32,
+                            _mm512_mask_compressstoreu_epi32)
+__CVEC_DEFINE_AVX512_FILTER(uint64_t, __m512i, 8, __cvec_ld512i,
+                            __cvec_set1_512epi64,
+                            _mm512_mask_compressstoreu_epi64)
+
+#define __cvec_simd_pick_filter(__name, __T, __n)                             \
+  ((__n) < __CVEC_SIMD_MIN ? NULL                                             \
+   : __cvec_has_avx512()   ? __cvec_##__name##_avx512_##__T                   \
+   : __cvec_has_avx2() && __cvec_has_bmi2() ? __cvec_##__name##_avx2_##__T    \
+                                            : NULL)
+#else
+#define __cvec_simd_pick_filter(__name, __T, __n) NULL
+#endif /* __CVEC_X86 */
+
+#define __CVEC_DEFINE_FILTER_KIND(__name, __T, __O)                           \
+  static inline size_t __cvec_##__name##_##__T(const __T *p, size_t n,        \
+                                               int op, __T value, __O *out)   \
+  {                                                                           \
+    size_t (*k)(const __T *, size_t, int, __T, __O *) =                       \
+        __cvec_simd_pick_filter(__name, __T, n);                              \
+    return k ? k(p, n, op, value, out)                                        \
+             : __cvec_##__name##_scalar_##__T(p, n, op, value, out);          \
+  }
+
+#define __CVEC_DEFINE_FILTER(__T)                                             \
+  __CVEC_DEFINE_FILTER_KIND(filter, __T, __T)                                 \
+  __CVEC_DEFINE_FILTER_KIND(select, __T, size_t)                              \
+  __CVEC_DEFINE_FILTER_KIND(mask, __T, uint64_t)
+
+__CVEC_DEFINE_FILTER(float)
+__CVEC_DEFINE_FILTER(double)
+__CVEC_DEFINE_FILTER(int32_t)
+__CVEC_DEFINE_FILTER(uint64_t)
+
+#if INT_MAX == INT32_MAX
+#define __cvec_filter_int(__p, __n, __op, __value, __out)                     \
+  __cvec_filter_int32_t((const int32_t *) (__p), __n, __op, __value,          \
+                        (int32_t *) (__out))
+#define __cvec_select_int(__p, __n, __op, __value, __out)                     \
+  __cvec_select_int32_t((const int32_t *) (__p), __n, __op, __value, __out)
+#define __cvec_mask_int(__p, __n, __op, __value, __out)                       \
+  __cvec_mask_int32_t((const int32_t *) (__p), __n, __op, __value, __out)
+#endif
+
+/*
+ * cvec_filter_cmp: Copy the items of a vector that compare true against a
+ *                  value into another vector.
+ *
+ * __dst:   The vector to store the matching items in.
+ * __src:   The vector to filter.
+ * __T:     The type of the items contained in both vectors.
+ * __op:    One of CVEC_LT, CVEC_LE, CVEC_GT, CVEC_GE, CVEC_EQ or CVEC_NE.
+ * __value: The value each item is compared against.
+ *
+ * __dst is cleared first and the matching items keep their relative order.
+ * Supports the same item types as cvec_sum.
+ */
+#define cvec_filter_cmp(__dst, __src, __T, __op, __value)                     \
+  do                                                                          \
+  {                                                                           \
+    cvec_clear(__dst);                                                        \
+    __cvec_grow_to(__dst, (__src).__n + __CVEC_FILTER_SLACK);                 \
+    (__dst).__n = __cvec_filter_##__T(cvec_begin(__src), (__src).__n, (__op), \
+                                      (__value), (__dst).__data);             \
+  } while (0)
+
+/*
+ * cvec_select_cmp: Store the positions of the items of a vector that compare
+ *                  true against a value.
+ *
+ * __sel:   A cvec_t(size_t) to store the positions in, in ascending order.
+ * __src:   The vector to filter.
+ * __T:     The type of the items contained in __src.
+ * __op:    One of CVEC_LT, CVEC_LE, CVEC_GT, CVEC_GE, CVEC_EQ or CVEC_NE.
+ * __value: The value each item is compared against.
+ *
+ * __sel is cleared first. The result can be passed to cvec_erase_indices.
+ */
+#define cvec_select_cmp(__sel, __src, __T, __op, __value)                     \
+  do                                                                          \
+  {                                                                           \
+    cvec_clear(__sel);                                                        \
+    __cvec_grow_to(__sel, (__src).__n + 1);                                   \
+    (__sel).__n = __cvec_select_##__T(cvec_begin(__src), (__src).__n, (__op), \
+                                      (__value), (__sel).__data);             \
+  } while (0)
+
+/*
+ * cvec_mask_cmp: Store one bit per item of a vector telling whether it
+ *                compares true against a value.
+ *
+ * __mask:  A cvec_t(uint64_t) to store the bits in. Bit i % 64 of item
+ *          i / 64 belongs to item i of __src, and unused high bits of the
+ *          last item are zero.
+ * __src:   The vector to filter.
+ * __T:     The type of the items contained in __src.
+ * __op:    One of CVEC_LT, CVEC_LE, CVEC_GT, CVEC_GE, CVEC_EQ or CVEC_NE.
+ * __value: The value each item is compared against.
+ *
+ * __mask is cleared first.
+ */
+#define cvec_mask_cmp(__mask, __src, __T, __op, __value)                      \
+  do                                                                          \
+  {                                                                           \
+    cvec_clear(__mask);                                                       \
+    __cvec_grow_to(__mask, ((__src).__n + 63) / 64 + 1);                      \
+    (__mask).__n = __cvec_mask_##__T(cvec_begin(__src), (__src).__n, (__op),  \
+                                     (__value), (__mask).__data);             \
+  } while (0)
+
+/*
+ * How many items ahead the gather and scatter loops prefetch. Random
+ * accesses into large vectors are dominated by cache misses, and this
+ * keeps that many of them in flight.
+ */
+#ifndef CVEC_PREFETCH_DISTANCE
+#define CVEC_PREFETCH_DISTANCE 16
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __cvec_prefetch(__p) __builtin_prefetch((__p), 0)
+#define __cvec_prefetchw(__p) __builtin_prefetch((__p), 1)
+#else
+#define __cvec_prefetch(__p) ((void) 0)
+#define __cvec_prefetchw(__p) ((void) 0)
+#endif
+
+/*
+ * Gather kernels for 4 and 8 byte items. Items are copied with memcpy so
+ * that any item type of that size can be moved without aliasing issues.
+ */
+#define __CVEC_DEFINE_SCALAR_GATHER(__w)                                      \
+  static inline void __cvec_gather_scalar_##__w(                              \
+      unsigned char *out, const unsigned char *src, const size_t *idx,        \
+      size_t n)                                                               \
+  {                                                                           \
+    size_t i = 0;                                                             \
+    for (; i + CVEC_PREFETCH_DISTANCE < n; ++i)                               \
+    {                                                                         \
+      __cvec_prefetch(src + idx[i + CVEC_PREFETCH_DISTANCE] * __w);           \
+      memcpy(out + i * __w, src + idx[i] * __w, __w);                         \
+    }                                                                         \
+    for (; i < n; ++i)                                                        \
+      memcpy(out + i * __w, src + idx[i] * __w, __w);                         \
+  }
+
+__CVEC_DEFINE_SCALAR_GATHER(4)
+__CVEC_DEFINE_SCALAR_GATHER(8)
+
+#ifdef __CVEC_X86
+/*
+ * __gather loads __L items given __L 64-bit indices, and __store writes
+ * them to out. Both loops prefetch ahead like the portable kernel.
+ */
+#define __CVEC_DEFINE_SIMD_GATHER(__isa, __tgt, __w, __L, __I, __ldidx,       \
+                                  __gather, __store)                          \
+  __cvec_target(__tgt) static inline void __cvec_gather_##__isa##_##__w(      \
+      unsigned char *out, const unsigned char *src, const size_t *idx,        \
+      size_t n)                                                               \
+  {                                                                           \
+    size_t i = 0;                                                             \
+    for (; i + __L + CVEC_PREFETCH_DISTANCE <= n; i += __L)                   \
+    {                                                                         \
+      __I x = __ldidx(idx + i);                                               \
+      for (size_t j = 0; j < __L; ++j)                                        \
+        __cvec_prefetch(src + idx[i + CVEC_PREFETCH_DISTANCE + j] * __w);     \
+      __store(out + i * __w, __gather(x, src));                               \
+    }                                                                         \
+    __cvec_gather_scalar_##__w(out + i * __w, src, idx + i, n - i);           \
+  }
+
+#define __cvec_i64gather_avx2_4(__x, __src)                                   \
+  _mm256_i64gather_epi32((const int *) (__src), __x, 4)
+#define __cvec_i64gather_avx2_8(__x, __src)                                   \
+  _mm256_i64gather_epi64((const long long *) (__src), __x, 8)
+#define __cvec_i64gather_avx512_4(__x, __src)                                 \
+  _mm512_i64gather_epi32(__x, (const void *) (__src), 4)
+#define __cvec_i64gather_avx512_8(__x, __src)                                 \
+  _mm512_i64gather_epi64(__x, (const void *) (__src), 8)
+#define __cvec_st128i(__p, __x) _mm_storeu_si128((__m128i *) (__p), __x)
+
+__CVEC_DEFINE_SIMD_GATHER(avx2, "avx2", 4, 4, __m256i, __cvec_ld256i,
+                          __cvec_i64gather_avx2_4, __cvec_st128i)
+__CVEC_DEFINE_SIMD_GATHER(avx2, "avx2", 8, 4, __m256i, __cvec_ld256i,
+                          __cvec_i64gather_avx2_8, __cvec_st256i)
+__CVEC_DEFINE_SIMD_GATHER(avx512, "avx512f", 4, 8, __m512i, __cvec_ld512i,
+                          __cvec_i64gather_avx512_4, __cvec_st256i)
+__CVEC_DEFINE_SIMD_GATHER(avx512, "avx512f", 8, 8, __m512i, __cvec_ld512i,
+                          __cvec_i64gather_avx512_8, __cvec_st512i)
+#endif /* __CVEC_X86 */
+
+#define __CVEC_DEFINE_GATHER(__w)                                             \
+  static inline void __cvec_gather_##__w(void *out, const void *src,          \
+                                         const size_t *idx, size_t n)         \
+  {                                                                           \
+    void (*k)(unsigned char *, const unsigned char *, const size_t *,         \
+              size_t) = __cvec_simd_pick(gather, __w, n);                     \
+    if (!k)                                                                   \
+      k = __cvec_gather_scalar_##__w;                                         \
+    k((unsigned char *) out, (const unsigned char *) src, idx, n);            \
+  }
+
+__CVEC_DEFINE_GATHER(4)
+__CVEC_DEFINE_GATHER(8)
+
+/*
+ * cvec_gather: Copy the items of a vector at a list of positions into
+ *              another vector.
+ *
+ * __dst: The vector to store the items in.
+ * __src: The vector to copy items from.
+ * __idx: A cvec_t(size_t) of positions in __src.
+ *
+ * __dst is cleared first, and then item i of __dst is item __idx[i] of
+ * __src. Note that no bounds checking is performed on the positions.
+ * Vectors of 4 and 8 byte items use hardware gathers where available.
+ */
+#define cvec_gather(__dst, __src, __idx)                                      \
+  do                                                                          \
+  {                                                                           \
+    const size_t *__gi = cvec_begin(__idx);                                   \
+    size_t __gn = (__idx).__n;                                                \
+    cvec_clear(__dst);                                                        \
+    __cvec_grow_to(__dst, __gn);                                              \
+    if ((__src).__t == 4)                                                     \
+      __cvec_gather_4((__dst).__data, (__src).__data, __gi, __gn);            \
+    else if ((__src).__t == 8)                                                \
+      __cvec_gather_8((__dst).__data, (__src).__data, __gi, __gn);            \
+    else                                                                      \
+      for (size_t __x = 0; __x < __gn; ++__x)                                 \
+      {                                                                       \
+        if (__x + CVEC_PREFETCH_DISTANCE < __gn)                              \
+          __cvec_prefetch(                                                    \
+              (__src).__data + __gi[__x + CVEC_PREFETCH_DISTANCE]);           \
+        (__dst).__data[__x] = (__src).__data[__gi[__x]];                      \
+      }                                                                       \
+    (__dst).__n = __gn;                                                       \
+  } while (0)
+
+/*
+ * cvec_scatter: Copy the items of a vector to a list of positions in another
+ *               vector.
+ *
+ * __dst: The vector to store the items in.
+ * __idx: A cvec_t(size_t) of positions in __dst.
+ * __src: The vector to copy items from.
+ *
+ * Item __idx[i] of __dst is overwritten with item i of __src. The size of
+ * __dst is left unchanged and no bounds checking is performed on the
+ * positions, so __dst must already hold enough items.
+ */
+#define cvec_scatter(__dst, __idx, __src)                                     \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__dst);                                                    \
+    const size_t *__si = cvec_begin(__idx);                                   \
+    size_t __sn = (__idx).__n < (__src).__n ? (__idx).__n : (__src).__n;      \
+    for (size_t __x = 0; __x < __sn; ++__x)                                   \
+    {                                                                         \
+      if (__x + CVEC_PREFETCH_DISTANCE < __sn)                                \
+        __cvec_prefetchw(                                                     \
+            (__dst).__data + __si[__x + CVEC_PREFETCH_DISTANCE]);             \
+      (__dst).__data[__si[__x]] = (__src).__data[__x];                        \
+    }                                                                         \
+  } while (0)
+
+/*
+ * cvec_permute_inplace: Reorder the items of a vector by a permutation.
+ *
+ * __v:    The vector.
+ * __perm: A cvec_t(size_t) holding a permutation of the positions in __v.
+ *
+ * Afterwards item i of __v is the item that was at position __perm[i]. The
+ * permutation is applied one cycle at a time, so the only extra memory used
+ * is one bit per item to remember which positions have been moved.
+ */
+#define cvec_permute_inplace(__v, __perm)                                     \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    const size_t *__pp = cvec_begin(__perm);                                  \
+    size_t __pn = (__v).__n;                                                  \
+    size_t __pw = (__pn + 63) / 64;                                           \
+    uint64_t *__done = malloc(__pw * sizeof(uint64_t) + (__v).__t);           \
+    unsigned char *__tmp = (unsigned char *) (__done + __pw);                 \
+    if (!__done)                                                              \
+    {                                                                         \
+      (__v).__e = CVEC_EOOM;                                                  \
+      break;                                                                  \
+    }                                                                         \
+    memset(__done, 0, __pw * sizeof(uint64_t));                               \
+    for (size_t __s = 0; __s < __pn; ++__s)                                   \
+    {                                                                         \
+      size_t __j = __s;                                                       \
+      size_t __k;                                                             \
+      if (__done[__s / 64] >> (__s % 64) & 1)                                 \
+        continue;                                                             \
+      memcpy(__tmp, (__v).__data + __s, (__v).__t);                           \
+      while ((__k = __pp[__j]) != __s)                                        \
+      {                                                                       \
+        (__v).__data[__j] = (__v).__data[__k];                                \
+        __done[__j / 64] |= (uint64_t) 1 << (__j % 64);                       \
+        __j = __k;                                                            \
+      }                                                                       \
+      memcpy((__v).__data + __j, __tmp, (__v).__t);                           \
+      __done[__j / 64] |= (uint64_t) 1 << (__j % 64);                         \
+    }                                                                         \
+    free(__done);                                                             \
+  } while (0)
+
+/*
+ * Binary and 4-ary heaps over a vector.
+ *
+ * The heap macros keep the greatest item under __less at the front, so
+ * cvec_front returns the top of the heap. __less is expanded inline, so it
+ * can be a macro or a static inline function with the following signature:
+ *     int <func>(__T a, __T b);
+ * returning non-zero if a orders before b.
+ *
+ * The 4-ary heap is half as deep as the binary heap, and the four children
+ * of an item usually share a cache line, so it takes fewer cache misses on
+ * large heaps at the cost of a few more comparisons per level.
+ */
+
+/* The heap order, reversed when __rev is set */
+#define __cvec_heap_less(__less, __rev, __a, __b)                             \
+  ((__rev) ? __less((__b), (__a)) : __less((__a), (__b)))
+
+/* Moves item __i of a __D-ary heap up to its place */
+#define __cvec_sift_up(__d, __T, __less, __rev, __D, __i)                     \
+  do                                                                          \
+  {                                                                           \
+    size_t __hi = (__i);                                                      \
+    __T __hx = (__d)[__hi];                                                   \
+    while (__hi > 0)                                                          \
+    {                                                                         \
+      size_t __hp = (__hi - 1) / (__D);                                       \
+      if (!__cvec_heap_less(__less, __rev, (__d)[__hp], __hx))                \
+        break;                                                                \
+      (__d)[__hi] = (__d)[__hp];                                              \
+      __hi = __hp;                                                            \
+    }                                                                         \
+    (__d)[__hi] = __hx;                                                       \
+  } while (0)
+
+/* Moves item __i of a __D-ary heap of __n items down to its place */
+#define __cvec_sift_down(__d, __n, __T, __less, __rev, __D, __i)              \
+  do                                                                          \
+  {                                                                           \
+    size_t __hi = (__i);                                                      \
+    size_t __hn = (__n);                                                      \
+    __T __hx = (__d)[__hi];                                                   \
+    for (;;)                                                                  \
+    {                                                                         \
+      size_t __hc = __hi * (__D) + 1;                                         \
+      size_t __hb = __hc;                                                     \
+      size_t __he;                                                            \
+      if (__hc >= __hn)                                                       \
+        break;                                                                \
+      __he = __hn - __hc > (__D) ? __hc + (__D) : __hn;                       \
+      for (++__hc; __hc < __he; ++__hc)                                       \
+        if (__cvec_heap_less(__less, __rev, (__d)[__hb], (__d)[__hc]))        \
+          __hb = __hc;                                                        \
+      if (!__cvec_heap_less(__less, __rev, __hx, (__d)[__hb]))                \
+        break;                                                                \
+      (__d)[__hi] = (__d)[__hb];                                              \
+      __hi = __hb;                                                            \
+    }                                                                         \
+    (__d)[__hi] = __hx;                                                       \
+  } while (0)
+
+/* Adds an item to a __D-ary heap */
+#define __cvec_heap_push(__v, __T, __less, __item, __D)                       \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    __cvec_maybe_grow(__v);                                                   \
+    (__v).__data[(__v).__n++] = (__item);                                     \
+    __cvec_sift_up((__v).__data, __T, __less, 0, __D, (__v).__n - 1);         \
+  } while (0)
+
+/* Removes the top item of a __D-ary heap */
+#define __cvec_heap_pop(__v, __T, __less, __D)                                \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    if ((__v).__n > 0)                                                        \
+    {                                                                         \
+      if ((__v).__on_free)                                                    \
+        (__v).__on_free((__v).__data[0]);                                     \
+      if (--(__v).__n > 0)                                                    \
+      {                                                                       \
+        (__v).__data[0] = (__v).__data[(__v).__n];                            \
+        __cvec_sift_down((__v).__data, (__v).__n, __T, __less, 0, __D, 0);    \
+      }                                                                       \
+    }                                                                         \
+  } while (0)
+
+/* Replaces the top item of a __D-ary heap */
+#define __cvec_heap_replace_top(__v, __T, __less, __item, __D)                \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    if ((__v).__n == 0)                                                       \
+    {                                                                         \
+      __cvec_heap_push(__v, __T, __less, __item, __D);                        \
+      break;                                                                  \
+    }                                                                         \
+    if ((__v).__on_free)                                                      \
+      (__v).__on_free((__v).__data[0]);                                       \
+    (__v).__data[0] = (__item);                                               \
+    __cvec_sift_down((__v).__data, (__v).__n, __T, __less, 0, __D, 0);        \
+  } while (0)
+
+/* Turns the first __n items into a __D-ary heap */
+#define __cvec_heapify(__d, __n, __T, __less, __rev, __D)                     \
+  do                                                                          \
+  {                                                                           \
+    size_t __hk = (__n);                                                      \
+    if (__hk < 2)                                                             \
+      break;                                                                  \
+    for (size_t __hj = (__hk - 2) / (__D) + 1; __hj-- > 0;)                   \
+      __cvec_sift_down(__d, __hk, __T, __less, __rev, __D, __hj);             \
+  } while (0)
+
+/*
+ * cvec_heap_push: Add an item to a binary heap.
+ *
+ * __v:    The vector holding the heap.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ * __item: The item to add.
+ */
+#define cvec_heap_push(__v, __T, __less, __item)                              \
+  __cvec_heap_push(__v, __T, __less, __item, 2)
+
+/*
+ * cvec_heap_pop: Remove the top item of a binary heap.
+ *
+ * __v:    The vector holding the heap.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ */
+#define cvec_heap_pop(__v, __T, __less) __cvec_heap_pop(__v, __T, __less, 2)
+
+/*
+ * cvec_heap_replace_top: Replace the top item of a binary heap.
+ *
+ * __v:    The vector holding the heap.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ * __item: The item to put in place of the top.
+ *
+ * This is the same as a pop followed by a push, but only restores the heap
+ * once. If the heap is empty, the item is pushed.
+ */
+#define cvec_heap_replace_top(__v, __T, __less, __item)                       \
+  __cvec_heap_replace_top(__v, __T, __less, __item, 2)
+
+/*
+ * cvec_heapify: Reorder the items of a vector into a binary heap.
+ *
+ * __v:    The vector.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ */
+#define cvec_heapify(__v, __T, __less)                                        \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    __cvec_heapify((__v).__data, (__v).__n, __T, __less, 0, 2);               \
+  } while (0)
+
+/*
+ * cvec_heap4_push: Add an item to a 4-ary heap.
+ *
+ * __v:    The vector holding the heap.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ * __item: The item to add.
+ */
+#define cvec_heap4_push(__v, __T, __less, __item)                             \
+  __cvec_heap_push(__v, __T, __less, __item, 4)
+
+/*
+ * cvec_heap4_pop: Remove the top item of a 4-ary heap.
+ *
+ * __v:    The vector holding the heap.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ */
+#define cvec_heap4_pop(__v, __T, __less) __cvec_heap_pop(__v, __T, __less, 4)
+
+/*
+ * cvec_heap4_replace_top: Replace the top item of a 4-ary heap.
+ *
+ * __v:    The vector holding the heap.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ * __item: The item to put in place of the top.
+ */
+#define cvec_heap4_replace_top(__v, __T, __less, __item)                      \
+  __cvec_heap_replace_top(__v, __T, __less, __item, 4)
+
+/*
+ * cvec_heap4_heapify: Reorder the items of a vector into a 4-ary heap.
+ *
+ * __v:    The vector.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order the heap by.
+ */
+#define cvec_heap4_heapify(__v, __T, __less)                                  \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    __cvec_heapify((__v).__data, (__v).__n, __T, __less, 0, 4);               \
+  } while (0)
+
+/*
+ * cvec_top_k: Copy the greatest items of a vector, greatest first.
+ *
+ * __dst:  The vector to write to. It is cleared first.
+ * __src:  The vector to read from.
+ * __T:    The type of the items contained in the vectors.
+ * __less: The comparison to order items by.
+ * __k:    The number of items to copy. Fewer are copied if __src is
+ *         smaller.
+ *
+ * The k greatest items so far are kept in a 4-ary heap with the least of
+ * them on top, so each remaining item of __src costs one comparison unless
+ * it belongs in the result. __src is not modified.
+ *
+ * The items are copied as they are, not what they point to, so __dst should
+ * not have an __on_free function that releases items __src still holds.
+ */
+#define cvec_top_k(__dst, __src, __T, __less, __k)                            \
+  do                                                                          \
+  {                                                                           \
+    size_t __tk = (__k) < (__src).__n ? (__k) : (__src).__n;                  \
+    __T *__td;                                                                \
+    cvec_clear(__dst);                                                        \
+    if (__tk == 0)                                                            \
+      break;                                                                  \
+    __cvec_grow_to(__dst, __tk);                                              \
+    __td = (__dst).__data;                                                    \
+    memcpy(__td, (__src).__data, __tk * sizeof(__T));                         \
+    __cvec_heapify(__td, __tk, __T, __less, 1, 4);                            \
+    for (size_t __ti = __tk; __ti < (__src).__n; ++__ti)                      \
+      if (__less(__td[0], (__src).__data[__ti]))                              \
+      {                                                                       \
+        __td[0] = (__src).__data[__ti];                                       \
+        __cvec_sift_down(__td, __tk, __T, __less, 1, 4, 0);                   \
+      }                                                                       \
+    for (size_t __ti = __tk - 1; __ti > 0; --__ti)                            \
+    {                                                                         \
+      __T __tx = __td[0];                                                     \
+      __td[0] = __td[__ti];                                                   \
+      __cvec_sift_down(__td, __ti, __T, __less, 1, 4, 0);                     \
+      __td[__ti] = __tx;                                                      \
+    }                                                                         \
+    (__dst).__n = __tk;                                                       \
+  } while (0)
+
+/*
+ * Selection and partial sorting.
+ *
+ * These take __T and __less the same way as the heap macros above, with
+ * __less expanded inline. They use introselect: Hoare partitioning around
+ * a median of three, or of nine on larger ranges, with a fall back to a
+ * heap once the partitions stop shrinking, so the worst case stays at
+ * O(n log n) instead of O(n^2).
+ */
+
+/* Swaps two lvalues of type __T */
+#define __cvec_swap(__T, __a, __b)                                            \
+  do                                                                          \
+  {                                                                           \
+    __T __sw = (__a);                                                         \
+    (__a) = (__b);                                                            \
+    (__b) = __sw;                                                             \
+  } while (0)
+
+/* The index of the median of three items */
+#define __cvec_med3(__d, __less, __a, __b, __c)                               \
+  (__less((__d)[__a], (__d)[__b])                                             \
+       ? (__less((__d)[__b], (__d)[__c])                                      \
+              ? (__b)                                                         \
+              : __less((__d)[__a], (__d)[__c]) ? (__c) : (__a))               \
+       : (__less((__d)[__a], (__d)[__c])                                      \
+              ? (__a)                                                         \
+              : __less((__d)[__b], (__d)[__c]) ? (__c) : (__b)))
+
+/*
+ * Partitions the items in [__lo, __hi), at least two of them, and sets
+ * __cut to a position strictly inside the range such that no item before it
+ * orders after any item from it on.
+ */
+#define __cvec_partition(__d, __lo, __hi, __T, __less, __cut)                 \
+  do                                                                          \
+  {                                                                           \
+    size_t __pl = (__lo);                                                     \
+    size_t __ph = (__hi);                                                     \
+    size_t __pm = __pl + ((__ph - __pl) >> 1);                                \
+    size_t __pi = __pl - 1;                                                   \
+    size_t __pj = __ph;                                                       \
+    if (__ph - __pl >= 128)                                                   \
+    {                                                                         \
+      size_t __ps = (__ph - __pl) >> 3;                                       \
+      size_t __p0 =                                                           \
+          __cvec_med3(__d, __less, __pl, __pl + __ps, __pl + 2 * __ps);       \
+      size_t __p1 = __cvec_med3(__d, __less, __pm - __ps, __pm, __pm + __ps); \
+      size_t __p2 = __cvec_med3(__d, __less, __ph - 1 - 2 * __ps,             \
+                                __ph - 1 - __ps, __ph - 1);                   \
+      __pm = __cvec_med3(__d, __less, __p0, __p1, __p2);                      \
+    }                                                                         \
+    else                                                                      \
+      __pm = __cvec_med3(__d, __less, __pl, __pm, __ph - 1);                  \
+    __cvec_swap(__T, (__d)[__pl], (__d)[__pm]);                               \
+    {                                                                         \
+      __T __pv = (__d)[__pl];                                                 \
+      for (;;)                                                                \
+      {                                                                       \
+        do                                                                    \
+          ++__pi;                                                             \
+        while (__less((__d)[__pi], __pv));                                    \
+        do                                                                    \
+          --__pj;                                                             \
+        while (__less(__pv, (__d)[__pj]));                                    \
+        if (__pi >= __pj)                                                     \
+          break;                                                              \
+        __cvec_swap(__T, (__d)[__pi], (__d)[__pj]);                           \
+      }                                                                       \
+    }                                                                         \
+    (__cut) = __pj + 1;                                                       \
+  } while (0)
+
+/* Sorts the items in [__lo, __hi) by insertion */
+#define __cvec_insertion_sort(__d, __lo, __hi, __T, __less)                   \
+  do                                                                          \
+  {                                                                           \
+    for (size_t __ii = (__lo) + 1; __ii < (__hi); ++__ii)                     \
+    {                                                                         \
+      __T __ix = (__d)[__ii];                                                 \
+      size_t __ij = __ii;                                                     \
+      for (; __ij > (__lo) && __less(__ix, (__d)[__ij - 1]); --__ij)          \
+        (__d)[__ij] = (__d)[__ij - 1];                                        \
+      (__d)[__ij] = __ix;                                                     \
+    }                                                                         \
+  } while (0)
+
+/*
+ * Puts the item of rank __k at index __k, with no larger item before it
+ * and no smaller one after it.
+ */
+#define __cvec_select(__d, __n, __T, __less, __k)                             \
+  do                                                                          \
+  {                                                                           \
+    size_t __sl = 0;                                                          \
+    size_t __sh = (__n);                                                      \
+    size_t __sk = (__k);                                                      \
+    size_t __sc;                                                              \
+    unsigned __sb = 0;                                                        \
+    if (__sk >= __sh)                                                         \
+      break;                                                                  \
+    for (size_t __sx = __sh; __sx > 1; __sx >>= 1)                            \
+      __sb += 2;                                                              \
+    while (__sh - __sl > 16)                                                  \
+    {                                                                         \
+      if (__sb-- == 0)                                                        \
+      {                                                                       \
+        __T *__sd = (__d) + __sl;                                             \
+        size_t __sm = __sk - __sl + 1;                                        \
+        __cvec_heapify(__sd, __sm, __T, __less, 0, 4);                        \
+        for (size_t __si = __sm; __si < __sh - __sl; ++__si)                  \
+          if (__less(__sd[__si], __sd[0]))                                    \
+          {                                                                   \
+            __cvec_swap(__T, __sd[__si], __sd[0]);                            \
+            __cvec_sift_down(__sd, __sm, __T, __less, 0, 4, 0);               \
+          }                                                                   \
+        __cvec_swap(__T, __sd[0], __sd[__sm - 1]);                            \
+        __sl = __sh;                                                          \
+        break;                                                                \
+      }                                                                       \
+      __cvec_partition(__d, __sl, __sh, __T, __less, __sc);                   \
+      if (__sk < __sc)                                                        \
+        __sh = __sc;                                                          \
+      else                                                                    \
+        __sl = __sc;                                                          \
+    }                                                                         \
+    __cvec_insertion_sort(__d, __sl, __sh, __T, __less);                      \
+  } while (0)
+
+/* Sorts __n items with introsort */
+#define __cvec_sort(__d, __n, __T, __less)                                    \
+  do                                                                          \
+  {                                                                           \
+    size_t __qlo[64];                                                         \
+    size_t __qhi[64];                                                         \
+    unsigned __qbud[64];                                                      \
+    unsigned __qt = 0;                                                        \
+    unsigned __qb = 0;                                                        \
+    size_t __ql = 0;                                                          \
+    size_t __qh = (__n);                                                      \
+    size_t __qc;                                                              \
+    for (size_t __qx = __qh; __qx > 1; __qx >>= 1)                            \
+      __qb += 2;                                                              \
+    for (;;)                                                                  \
+    {                                                                         \
+      if (__qh - __ql <= 16)                                                  \
+        __cvec_insertion_sort(__d, __ql, __qh, __T, __less);                  \
+      else if (__qb == 0)                                                     \
+      {                                                                       \
+        __T *__qd = (__d) + __ql;                                             \
+        __cvec_heapify(__qd, __qh - __ql, __T, __less, 0, 2);                 \
+        for (size_t __qe = __qh - __ql - 1; __qe > 0; --__qe)                 \
+        {                                                                     \
+          __cvec_swap(__T, __qd[0], __qd[__qe]);                              \
+          __cvec_sift_down(__qd, __qe, __T, __less, 0, 2, 0);                 \
+        }                                                                     \
+      }                                                                       \
+      else                                                                    \
+      {                                                                       \
+        __cvec_partition(__d, __ql, __qh, __T, __less, __qc);                 \
+        __qbud[__qt] = --__qb;                                                \
+        if (__qc - __ql < __qh - __qc)                                        \
+        {                                                                     \
+          __qlo[__qt] = __qc;                                                 \
+          __qhi[__qt++] = __qh;                                               \
+          __qh = __qc;                                                        \
+        }                                                                     \
+        else                                                                  \
+        {                                                                     \
+          __qlo[__qt] = __ql;                                                 \
+          __qhi[__qt++] = __qc;                                               \
+          __ql = __qc;                                                        \
+        }                                                                     \
+        continue;                                                             \
+      }                                                                       \
+      if (__qt == 0)                                                          \
+        break;                                                                \
+      --__qt;                                                                 \
+      __ql = __qlo[__qt];                                                     \
+      __qh = __qhi[__qt];                                                     \
+      __qb = __qbud[__qt];                                                    \
+    }                                                                         \
+  } while (0)
+
+/*
+ * cvec_nth_element: Put the item that would be at a position in sorted
+ *                   order at that position.
+ *
+ * __v:    The vector.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order items by.
+ * __pos:  The position.
+ *
+ * Afterwards no item before position __pos orders after it, and no item after
+ * it orders before it. This takes linear time on average, so it is the way
+ * to find a median or percentile without sorting. Nothing happens if __pos
+ * is past the end of the vector.
+ */
+#define cvec_nth_element(__v, __T, __less, __pos)                             \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    __cvec_select((__v).__data, (__v).__n, __T, __less, (__pos));             \
+  } while (0)
+
+/*
+ * cvec_select_k: Move the least items of a vector to the front.
+ *
+ * __v:    The vector.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order items by.
+ * __k:    The number of items to move.
+ *
+ * The first __k items are left in no particular order.
+ */
+#define cvec_select_k(__v, __T, __less, __k)                                  \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    __cvec_select((__v).__data, (__v).__n, __T, __less, (__k));               \
+  } while (0)
+
+/*
+ * cvec_partial_sort: Sort the least items of a vector at its front.
+ *
+ * __v:    The vector.
+ * __T:    The type of the items contained in the vector.
+ * __less: The comparison to order items by.
+ * __k:    The number of items to sort. The whole vector is sorted if this
+ *         is not less than its size.
+ *
+ * The remaining items are left in no particular order.
+ */
+#define cvec_partial_sort(__v, __T, __less, __k)                              \
+  do                                                                          \
+  {                                                                           \
+    __cvec_unshare(__v);                                                      \
+    size_t __pk = (__k) < (__v).__n ? (__k) : (__v).__n;                      \
+    __cvec_select((__v).__data, (__v).__n, __T, __less, __pk);                \
+    __cvec_sort((__v).__data, __pk, __T, __less);                             \
+  } while (0)
+
+/*
+ * Sorted set operations.
+ *
+ * These work on vectors sorted in ascending order. The inputs of
+ * cvec_set_intersection, cvec_set_union and cvec_set_difference are treated
+ * as sets and must not hold duplicates. When one input is more than
+ * __CVEC_GALLOP_RATIO times longer than the other, each item of the short
+ * one is found in the long one by galloping: probing 1, 2, 4, ... items
+ * ahead and then searching the last gap, so the cost follows the short
+ * input instead of the sum of both. Intersections of similar sizes of
+ * 32-bit items compare a whole register of one input against a whole
+ * register of the other at a time.
+ */
+
+/* Skew between input sizes above which the shorter input is galloped */
+#define __CVEC_GALLOP_RATIO 32
+
+#define __CVEC_DEFINE_SCALAR_SETOPS(__T)                                      \
+  static inline size_t __cvec_gallop_##__T(const __T *p, size_t lo, size_t n, \
+                                           __T x)                             \
+  {                                                                           \
+    size_t step = 1, hi;                                                      \
+    if (lo >= n || p[lo] >= x)                                                \
+      return lo;                                                              \
+    hi = lo + 1;                                                              \
+    while (hi < n && p[hi] < x)                                               \
+    {                                                                         \
+      lo = hi;                                                                \
+      step <<= 1;                                                             \
+      hi = n - lo > step ? lo + step : n;                                     \
+    }                                                                         \
+    while (hi - lo > 1)                                                       \
+    {                                                                         \
+      size_t mid = lo + ((hi - lo) >> 1);                                     \
+      if (p[mid] < x)                                                         \
+        lo = mid;                                                             \
+      else                                                                    \
+        hi = mid;                                                             \
+    }                                                                         \
+    return hi;                                                                \
+  }                                                                           \
+  static inline size_t __cvec_intersect_scalar_##__T(                         \
+      const __T *a, size_t na, const __T *b, size_t nb, __T *out)             \
+  {                                                                           \
+    size_t i = 0, j = 0, k = 0;                                               \
+    while (i < na && j < nb)                                                  \
+    {                                                                         \
+      __T x = a[i], y = b[j];                                                 \
+      out[k] = x;                                                             \
+      k += x == y;                                                            \
+      i += x <= y;                                                            \
+      j += y <= x;                                                            \
+    }                                                                         \
+    return k;                                                                 \
+  }                                                                           \
+  static inline size_t __cvec_intersect_gallop_##__T(                         \
+      const __T *s, size_t ns, const __T *l, size_t nl, __T *out)             \
+  {                                                                           \
+    size_t j = 0, k = 0;                                                      \
+    for (size_t i = 0; i < ns; ++i)                                           \
+    {                                                                         \
+      j = __cvec_gallop_##__T(l, j, nl, s[i]);                                \
+      if (j == nl)                                                            \
+        break;                                                                \
+      out[k] = s[i];                                                          \
+      k += l[j] == s[i];                                                      \
+    }                                                                         \
+    return k;                                                                 \
+  }                                                                           \
+  static inline size_t __cvec_union_##__T(const __T *a, size_t na,            \
+                                          const __T *b, size_t nb, __T *out)  \
+  {                                                                           \
+    size_t i = 0, j = 0, k = 0;                                               \
+    if (na > nb * __CVEC_GALLOP_RATIO || nb > na * __CVEC_GALLOP_RATIO)       \
+    {                                                                         \
+      const __T *s = na < nb ? a : b, *l = na < nb ? b : a;                   \
+      size_t ns = na < nb ? na : nb, nl = na < nb ? nb : na;                  \
+      for (; i < ns; ++i)                                                     \
+      {                                                                       \
+        size_t lb = __cvec_gallop_##__T(l, j, nl, s[i]);                      \
+        if (lb > j)                                                           \
+          memcpy(out + k, l + j, (lb - j) * sizeof(__T));                     \
+        k += lb - j;                                                          \
+        j = lb + (lb < nl && l[lb] == s[i]);                                  \
+        out[k++] = s[i];                                                      \
+      }                                                                       \
+      if (nl > j)                                                             \
+        memcpy(out + k, l + j, (nl - j) * sizeof(__T));                       \
+      return k + nl - j;                                                      \
+    }                                                                         \
+    while (i < na && j < nb)                                                  \
+    {                                                                         \
+      __T x = a[i], y = b[j];                                                 \
+      out[k++] = y < x ? y : x;                                               \
+      i += x <= y;                                                            \
+      j += y <= x;                                                            \
+    }                                                                         \
+    if (na > i)                                                               \
+      memcpy(out + k, a + i, (na - i) * sizeof(__T));                         \
+    k += na - i;                                                              \
+    if (nb > j)                                                               \
+      memcpy(out + k, b + j, (nb - j) * sizeof(__T));                         \
+    return k + nb - j;                                                        \
+  }                                                                           \
+  static inline size_t __cvec_merge_##__T(const __T *a, size_t na,            \
+                                          const __T *b, size_t nb, __T *out)  \
+  {                                                                           \
+    size_t i = 0, j = 0, k = 0;                                               \
+    if (na > nb * __CVEC_GALLOP_RATIO || nb > na * __CVEC_GALLOP_RATIO)       \
+    {                                                                         \
+      const __T *s = na < nb ? a : b, *l = na < nb ? b : a;                   \
+      size_t ns = na < nb ? na : nb, nl = na < nb ? nb : na;                  \
+      for (; i < ns; ++i)                                                     \
+      {                                                                       \
+        size_t lb = __cvec_gallop_##__T(l, j, nl, s[i]);                      \
+        if (lb > j)                                                           \
+          memcpy(out + k, l + j, (lb - j) * sizeof(__T));                     \
+        k += lb - j;                                                          \
+        j = lb;                                                               \
+        out[k++] = s[i];                                                      \
+      }                                                                       \
+      if (nl > j)                                                             \
+        memcpy(out + k, l + j, (nl - j) * sizeof(__T));                       \
+      return k + nl - j;                                                      \
+    }                                                                         \
+    while (i < na && j < nb)                                                  \
+    {                                                                         \
+      __T x = a[i], y = b[j];                                                 \
+      int c = y < x;                                                          \
+      out[k++] = c ? y : x;                                                   \
+      i += !c;                                                                \
+      j += c;                                                                 \
+    }                                                                         \
+    if (na > i)                                                               \
+      memcpy(out + k, a + i, (na - i) * sizeof(__T));                         \
+    k += na - i;                                                              \
+    if (nb > j)                                                               \
+      memcpy(out + k, b + j, (nb - j) * sizeof(__T));                         \
+    return k + nb - j;                                                        \
+  }                                                                           \
+  static inline size_t __cvec_difference_##__T(                               \
+      const __T *a, size_t na, const __T *b, size_t nb, __T *out)             \
+  {                                                                           \
+    size_t i = 0, j = 0, k = 0;                                               \
+    if (na > nb * __CVEC_GALLOP_RATIO)                                        \
+    {                                                                         \
+      for (; j < nb; ++j)                                                     \
+      {                                                                       \
+        size_t lb = __cvec_gallop_##__T(a, i, na, b[j]);                      \
+        if (lb > i)                                                           \
+          memcpy(out + k, a + i, (lb - i) * sizeof(__T));                     \
+        k += lb - i;                                                          \
+        i = lb + (lb < na && a[lb] == b[j]);                                  \
+      }                                                                       \
+    }                                                                         \
+    else if (nb > na * __CVEC_GALLOP_RATIO)                                   \
+    {                                                                         \
+      for (; i < na; ++i)                                                     \
+      {                                                                       \
+        j = __cvec_gallop_##__T(b, j, nb, a[i]);                              \
+        out[k] = a[i];                                                        \
+        k += j == nb || b[j] != a[i];                                         \
+      }                                                                       \
+    }                                                                         \
+    else                                                                      \
+      while (i < na && j < nb)                                                \
+      {                                                                       \
+        __T x = a[i], y = b[j];                                               \
+        out[k] = x;                                                           \
+        k += x < y;                                                           \
+        i += x <= y;                                                          \
+        j += y <= x;                                                          \
+      }                                                                       \
+    if (na > i)                                                               \
+      memcpy(out + k, a + i, (na - i) * sizeof(__T));                         \
+    return k + na - i;                                                        \
+  }
+
+__CVEC_DEFINE_SCALAR_SETOPS(uint32_t)
+__CVEC_DEFINE_SCALAR_SETOPS(int32_t)
+__CVEC_DEFINE_SCALAR_SETOPS(uint64_t)
+__CVEC_DEFINE_SCALAR_SETOPS(int64_t)
+
+#ifdef __CVEC_X86
+/*
+ * Block intersection: every item of a register of a is compared against
+ * every rotation of a register of b, the matches are packed to the front,
+ * and whichever register ends with the smaller item is advanced. Since
+ * neither input has duplicates, an item can match at most once.
+ */
+#define __CVEC_DEFINE_SIMD_INTERSECT(__T)                                     \
+  __cvec_target("avx2,bmi2") static inline size_t                             \
+  __cvec_intersect_avx2_##__T(const __T *a, size_t na, const __T *b,          \
+                              size_t nb, __T *out)                            \
+  {                                                                           \
+    const __m256i rot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);            \
+    size_t i = 0, j = 0, k = 0;                                               \
+    while (i + 8 <= na && j + 8 <= nb)                                        \
+    {                                                                         \
+      __m256i va = __cvec_ld256i(a + i);                                      \
+      __m256i vb = __cvec_ld256i(b + j);                                      \
+      __m256i eq = _mm256_cmpeq_epi32(va, vb);                                \
+      __T amax = a[i + 7], bmax = b[j + 7];                                   \
+      unsigned m;                                                             \
+      for (int r = 1; r < 8; ++r)                                             \
+      {                                                                       \
+        vb = _mm256_permutevar8x32_epi32(vb, rot);                            \
+        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));                 \
+      }                                                                       \
+      m = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(eq));             \
+      __cvec_compact32_avx2(out + k, va, m);                                  \
+      k += __builtin_popcount(m);                                             \
+      i += amax <= bmax ? 8 : 0;                                              \
+      j += bmax <= amax ? 8 : 0;                                              \
+    }                                                                         \
+    return k + __cvec_intersect_scalar_##__T(a + i, na - i, b + j, nb - j,    \
+                                             out + k);                        \
+  }                                                                           \
+  __cvec_target("avx512f") static inline size_t                               \
+  __cvec_intersect_avx512_##__T(const __T *a, size_t na, const __T *b,        \
+                                size_t nb, __T *out)                          \
+  {                                                                           \
+    size_t i = 0, j = 0, k = 0;                                               \
+    while (i + 16 <= na && j + 16 <= nb)                                      \
+    {                                                                         \
+      __m512i va = __cvec_ld512i(a + i);                                      \
+      __m512i vb = __cvec_ld512i(b + j);                                      \
+      __mmask16 m = _mm512_cmpeq_epi32_mask(va, vb);                          \
+      __T amax = a[i + 15], bmax = b[j + 15];                                 \
+      for (int r = 1; r < 16; ++r)                                            \
+      {                                                                       \
+        vb = _mm512_alignr_epi32(vb, vb, 1);                                  \
+        m |= _mm512_cmpeq_epi32_mask(va, vb);                                 \
+      }                                                                       \
+      _mm512_mask_compressstoreu_epi32(out + k, m, va);                       \
+      k += __builtin_popcount(m);                                             \
+      i += amax <= bmax ? 16 : 0;                                             \
+      j += bmax <= amax ? 16 : 0;                                             \
+    }                                                                         \
+    return k + __cvec_intersect_scalar_##__T(a + i, na - i, b + j, nb - j,    \
+                                             out + k);                        \
+  }
+
+__CVEC_DEFINE_SIMD_INTERSECT(uint32_t)
+__CVEC_DEFINE_SIMD_INTERSECT(int32_t)
+
+#define __cvec_simd_pick_intersect(__T, __n)                                  \
+  ((__n) < __CVEC_SIMD_MIN ? NULL                                             \
+   : __cvec_has_avx512()   ? __cvec_intersect_avx512_##__T                    \
+   : __cvec_has_avx2() && __cvec_has_bmi2() ? __cvec_intersect_avx2_##__T     \
+                                            : NULL)
+#else
+#define __cvec_simd_pick_intersect(__T, __n) NULL
+#endif /* __CVEC_X86 */
+
+/* Item types without a vector kernel */
+#define __cvec_no_simd_intersect(__T, __n) NULL
+
+#define __CVEC_DEFINE_SETOPS(__T, __pick)                                     \
+  static inline size_t __cvec_intersect_##__T(                                \
+      const __T *a, size_t na, const __T *b, size_t nb, __T *out)             \
+  {                                                                           \
+    size_t (*k)(const __T *, size_t, const __T *, size_t, __T *) =            \
+        __pick(__T, na < nb ? na : nb);                                       \
+    if (na > nb * __CVEC_GALLOP_RATIO)                                        \
+      return __cvec_intersect_gallop_##__T(b, nb, a, na, out);                \
+    if (nb > na * __CVEC_GALLOP_RATIO)                                        \
+      return __cvec_intersect_gallop_##__T(a, na, b, nb, out);                \
+    return k ? k(a, na, b, nb, out)                                           \
+             : __cvec_intersect_scalar_##__T(a, na, b, nb, out);              \
+  }
+
+__CVEC_DEFINE_SETOPS(uint32_t, __cvec_simd_pick_intersect)
+__CVEC_DEFINE_SETOPS(int32_t, __cvec_simd_pick_intersect)
+__CVEC_DEFINE_SETOPS(uint64_t, __cvec_no_simd_intersect)
+__CVEC_DEFINE_SETOPS(int64_t, __cvec_no_simd_intersect)
+
+#if INT_MAX == INT32_MAX
+#define __cvec_setop_int(__name, __a, __na, __b, __nb, __out)                 \
+  __cvec_##__name##_int32_t((const int32_t *) (__a), __na,                    \
+                            (const int32_t *) (__b), __nb,                    \
+                            (int32_t *) (__out))
+#define __cvec_intersect_int(__a, __na, __b, __nb, __out)                     \
+  __cvec_setop_int(intersect, __a, __na, __b, __nb, __out)
+#define __cvec_union_int(__a, __na, __b, __nb, __out)                         \
+  __cvec_setop_int(union, __a, __na, __b, __nb, __out)
+#define __cvec_difference_int(__a, __na, __b, __nb, __out)                    \
+  __cvec_setop_int(difference, __a, __na, __b, __nb, __out)
+#define __cvec_merge_int(__a, __na, __b, __nb, __out)                         \
+  __cvec_setop_int(merge, __a, __na, __b, __nb, __out)
+#endif
+
+/* Runs the typed set operation __name of __a and __b into __dst */
+#define __cvec_setop(__name, __dst, __a, __b, __T, __need)                    \
+  do                                                                          \
+  {                                                                           \
+    cvec_clear(__dst);                                                        \
+    __cvec_grow_to(__dst, (__need) + __CVEC_FILTER_SLACK);                    \
+    (__dst).__n = __cvec_##__name##_##__T(cvec_begin(__a), (__a).__n,         \
+                                          cvec_begin(__b), (__b).__n,         \
+                                          (__dst).__data);                    \
+  } while (0)
+
+/*
+ * cvec_set_intersection: Store the items found in both of two sorted sets.
+ *
+ * __dst: The vector to store the result in. It is cleared first.
+ * __a:   The first set.
+ * __b:   The second set.
+ * __T:   The type of the items, one of uint32_t, int32_t, uint64_t, int64_t
+ *        or int.
+ *
+ * __dst must not be __a or __b. It only grows if it does not already have
+ * room for the smaller input plus a few spare items, so a vector reserved
+ * once can be reused without allocating.
+ */
+#define cvec_set_intersection(__dst, __a, __b, __T)                           \
+  __cvec_setop(intersect, __dst, __a, __b, __T,                               \
+               (__a).__n < (__b).__n ? (__a).__n : (__b).__n)
+
+/*
+ * cvec_set_union: Store the items found in either of two sorted sets.
+ *
+ * __dst: The vector to store the result in. It is cleared first.
+ * __a:   The first set.
+ * __b:   The second set.
+ * __T:   The same item types as cvec_set_intersection.
+ *
+ * __dst must not be __a or __b. Items found in both sets are stored once.
+ */
+#define cvec_set_union(__dst, __a, __b, __T)                                  \
+  __cvec_setop(union, __dst, __a, __b, __T, (__a).__n + (__b).__n)
+
+/*
+ * cvec_set_difference: Store the items of a sorted set not found in
+ *                      another.
+ *
+ * __dst: The vector to store the result in. It is cleared first.
+ * __a:   The set to take items from.
+ * __b:   The set of items to leave out.
+ * __T:   The same item types as cvec_set_intersection.
+ *
+ * __dst must not be __a or __b.
+ */
+#define cvec_set_difference(__dst, __a, __b, __T)                             \
+  __cvec_setop(difference, __dst, __a, __b, __T, (__a).__n)
+
+/*
+ * cvec_merge: Store the items of two sorted vectors in sorted order.
+ *
+ * __dst: The vector to store the result in. It is cleared first.
+ * __a:   The first vector.
+ * __b:   The second vector.
+ * __T:   The same item types as cvec_set_intersection.
+ *
+ * __dst must not be __a or __b. Unlike cvec_set_union, items found in both
+ * vectors are stored twice, and either input may hold duplicates.
+ */
+#define cvec_merge(__dst, __a, __b, __T)                                      \
+  __cvec_setop(merge, __dst, __a, __b, __T, (__a).__n + (__b).__n)
+
+/*
+ * K-way merging.
+ *
+ * A loser tree holds, at each internal node, the run that lost the match
+ * played there, with the overall winner kept apart. Taking the winner's
+ * next item only replays the matches on the path from its leaf to the
+ * root, so each output item costs about log2(k) comparisons and no item
+ * is copied more than once.
+ */
+
+/*
+ * Whether the head of run __a goes before the head of run __b. An
+ * exhausted run goes last, and ties go to the lower run.
+ */
+#define __cvec_kway_less(__vecs, __pos, __less, __a, __b)                     \
+  ((__pos)[__a] == (__vecs)[__a].__n                                          \
+       ? 0                                                                    \
+   : (__pos)[__b] == (__vecs)[__b].__n                                        \
+       ? 1                                                                    \
+   : __less((__vecs)[__a].__data[(__pos)[__a]],                               \
+            (__vecs)[__b].__data[(__pos)[__b]])                               \
+       ? 1                                                                    \
+   : __less((__vecs)[__b].__data[(__pos)[__b]],                               \
+            (__vecs)[__a].__data[(__pos)[__a]])                               \
+       ? 0                                                                    \
+       : (__a) < (__b))
+
+/* Merges k sorted runs into __dst with a loser tree */
+#define __cvec_kway_merge(__dst, __vecs, __k, __less, __unique)               \
+  do                                                                          \
+  {                                                                           \
+    size_t __kk = (__k);                                                      \
+    size_t __kt = 0;                                                          \
+    size_t *__kl;                                                             \
+    size_t *__kw;                                                             \
+    size_t *__kp;                                                             \
+    cvec_clear(__dst);                                                        \
+    for (size_t __ki = 0; __ki < __kk; ++__ki)                                \
+      __kt += (__vecs)[__ki].__n;                                             \
+    if (__kt == 0)                                                            \
+      break;                                                                  \
+    __cvec_grow_to(__dst, __kt);                                              \
+    __kl = malloc(3 * __kk * sizeof(size_t));                                 \
+    if (!__kl)                                                                \
+    {                                                                         \
+      (__dst).__e = CVEC_EOOM;                                                \
+      break;                                                                  \
+    }                                                                         \
+    __kw = __kl + __kk;                                                       \
+    __kp = __kw + __kk;                                                       \
+    memset(__kp, 0, __kk * sizeof(size_t));                                   \
+    for (size_t __ki = __kk; __ki-- > 1;)                                     \
+    {                                                                         \
+      size_t __ka = 2 * __ki < __kk ? __kw[2 * __ki] : 2 * __ki - __kk;       \
+      size_t __kb =                                                           \
+          2 * __ki + 1 < __kk ? __kw[2 * __ki + 1] : 2 * __ki + 1 - __kk;     \
+      int __kx = __cvec_kway_less(__vecs, __kp, __less, __ka, __kb);          \
+      __kw[__ki] = __kx ? __ka : __kb;                                        \
+      __kl[__ki] = __kx ? __kb : __ka;                                        \
+    }                                                                         \
+    __kl[0] = __kk > 1 ? __kw[1] : 0;                                         \
+    while (__kt-- > 0)                                                        \
+    {                                                                         \
+      size_t __kr = __kl[0];                                                  \
+      if (!(__unique) || (__dst).__n == 0 ||                                  \
+          __less((__dst).__data[(__dst).__n - 1],                             \
+                 (__vecs)[__kr].__data[__kp[__kr]]))                          \
+        (__dst).__data[(__dst).__n++] = (__vecs)[__kr].__data[__kp[__kr]];    \
+      ++__kp[__kr];                                                           \
+      for (size_t __kn = (__kr + __kk) >> 1; __kn > 0; __kn >>= 1)            \
+        if (__cvec_kway_less(__vecs, __kp, __less, __kl[__kn], __kr))         \
+        {                                                                     \
+          size_t __ks = __kl[__kn];                                           \
+          __kl[__kn] = __kr;                                                  \
+          __kr = __ks;                                                        \
+        }                                                                     \
+      __kl[0] = __kr;                                                         \
+    }                                                                         \
+    free(__kl);                                                               \
+  } while (0)
+
+/*
+ * cvec_kway_merge: Merge many sorted vectors into one.
+ *
+ * __dst:  The vector to store the result in. It is cleared first and grown
+ *         once to the total size of the inputs.
+ * __vecs: A pointer to an array of __k vectors of the same type as __dst,
+ *         each sorted under __less.
+ * __k:    The number of vectors in __vecs.
+ * __less: The comparison the vectors are sorted by, expanded inline as for
+ *         the heap macros.
+ *
+ * Items that compare equal keep the order of the vectors they came from.
+ * The items are copied, so __dst must not be one of the inputs.
+ */
+#define cvec_kway_merge(__dst, __vecs, __k, __less)                           \
+  __cvec_kway_merge(__dst, __vecs, __k, __less, 0)
+
+/*
+ * cvec_kway_merge_unique: Merge many sorted vectors into one, keeping only
+ *                         the first of each run of equal items.
+ *
+ * __dst:  The vector to store the result in. It is cleared first.
+ * __vecs: A pointer to an array of __k vectors of the same type as __dst,
+ *         each sorted under __less.
+ * __k:    The number of vectors in __vecs.
+ * __less: The comparison the vectors are sorted by.
+ *
+ * When several vectors hold equal items, the one from the vector that comes
+ * first in __vecs is kept.
+ */
+#define cvec_kway_merge_unique(__dst, __vecs, __k, __less)                    \
+  __cvec_kway_merge(__dst, __vecs, __k, __less, 1)
+
+/*
+ * Sorting strings.
+ *
+ * Sorting strings with a comparison sort spends most of its time chasing
+ * each string's pointer and comparing prefixes that were already found
+ * equal. cvec_sort_strings uses multikey quicksort instead (Bentley and
+ * Sedgewick), on an array that caches the next 8 bytes of every string
+ * as one big-endian integer. Partitioning compares those integers without
+ * touching the strings, and only a run of strings that agree on all 8
+ * bytes goes back to them, to load the 8 after. No byte of a string is
+ * looked at more than once per partitioning level.
+ */
+
+/* A string being sorted, with the 8 bytes at the current depth in __pre */
+struct __cvec_skey
+{
+  uint64_t __pre;
+  const unsigned char *__str;
+  size_t __idx;
+};
+
+/* The 8 bytes at s as a big-endian integer, zero from the NUL on */
+static inline uint64_t
+__cvec_skey_load(const unsigned char *s)
+{
+  uint64_t k = 0;
+
+  for (int i = 0; i < 8 && s[i]; ++i)
+    k |= (uint64_t) s[i] << (56 - 8 * i);
+  return k;
+}
+
+/* Compares two strings whose first d bytes are equal */
+static inline int
+__cvec_skey_less(const struct __cvec_skey *a, const struct __cvec_skey *b,
+                 size_t d)
+{
+  if (a->__pre != b->__pre)
+    return a->__pre < b->__pre;
+  if (!(a->__pre & 0xff))
+    return 0;
+  return strcmp((const char *) a->__str + d + 8,
+                (const char *) b->__str + d + 8) < 0;
+}
+
+static inline uint64_t
+__cvec_skey_med3(uint64_t a, uint64_t b, uint64_t c)
+{
+  return a < b ? (b < c ? b : (a < c ? c : a))
+               : (a < c ? a : (b < c ? c : b));
+}
+
+/*
+ * Sorts n strings whose first d bytes are equal and whose keys hold the 8
+ * bytes after those. The largest of the three parts of each partition is
+ * sorted by the loop and the other two by recursion, so the recursion is
+ * never deeper than log2(n).
+ */
+static inline void
+__cvec_mkqs(struct __cvec_skey *a, size_t n, size_t d)
+{
+  while (n > 16)
+  {
+    size_t lt = 0;
+    size_t i = 0;
+    size_t gt = n;
+    size_t eq;
+    uint64_t p;
+
+    if (n > 128)
+    {
+      size_t s = n / 8;
+
+      p = __cvec_skey_med3(
+          __cvec_skey_med3(a[0].__pre, a[s].__pre, a[2 * s].__pre),
+          __cvec_skey_med3(a[n / 2 - s].__pre, a[n / 2].__pre,
+                           a[n / 2 + s].__pre),
+          __cvec_skey_med3(a[n - 1 - 2 * s].__pre, a[n - 1 - s].__pre,
+                           a[n - 1].__pre));
+    }
+    else
+      p = __cvec_skey_med3(a[0].__pre, a[n / 2].__pre, a[n - 1].__pre);
+    while (i < gt)
+    {
+      struct __cvec_skey x = a[i];
+
+      if (x.__pre < p)
+      {
+        a[i++] = a[lt];
+        a[lt++] = x;
+      }
+      else if (x.__pre > p)
+      {
+        a[i] = a[--gt];
+        a[gt] = x;
+      }
+      else
+        ++i;
+    }
+    /* Equal keys that hold a NUL are equal strings and need no more work */
+    eq = p & 0xff ? gt - lt : 0;
+    for (i = lt; i < lt + eq; ++i)
+      a[i].__pre = __cvec_skey_load(a[i].__str + d + 8);
+    if (eq >= lt && eq >= n - gt)
+    {
+      __cvec_mkqs(a, lt, d);
+      __cvec_mkqs(a + gt, n - gt, d);
+      a += lt;
+      n = eq;
+      d += 8;
+    }
+    else
+    {
+      __cvec_mkqs(a + lt, eq, d + 8);
+      if (lt < n - gt)
+      {
+        __cvec_mkqs(a, lt, d);
+        a += gt;
+        n -= gt;
+      }
+      else
+      {
+        __cvec_mkqs(a + gt, n - gt, d);
+        n = lt;
+      }
+    }
+  }
+  for (size_t i = 1; i < n; ++i)
+  {
+    struct __cvec_skey x = a[i];
+    size_t j = i;
+
+    for (; j > 0 && __cvec_skey_less(&x, &a[j - 1], d); --j)
+      a[j] = a[j - 1];
+    a[j] = x;
+  }
+}
+
+/* Sorts n keys whose __str and __idx are set */
+static inline void
+__cvec_skey_sort(struct __cvec_skey *keys, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    keys[i].__pre = __cvec_skey_load(keys[i].__str);
+  __cvec_mkqs(keys, n, 0);
+}
+
+/* Sorts the keys, then puts n items of t bytes at data in their order */
+static inline int
+__cvec_sort_strings(struct __cvec_skey *keys, size_t n, void *data, size_t t)
+{
+  unsigned char *tmp = malloc(n * t);
+
+  if (!tmp)
+    return CVEC_EOOM;
+  __cvec_skey_sort(keys, n);
+  for (size_t i = 0; i < n; ++i)
+    memcpy(tmp + i * t, (unsigned char *) data + keys[i].__idx * t, t);
+  memcpy(data, tmp, n * t);
+  free(tmp);
+  return CVEC_EOK;
+}
+
+/* The key of cvec_sort_strings, where each item is its own string */
+#define __cvec_str_self(__x) (__x)
+
+/*
+ * cvec_sort_strings_by: Sort a vector by a string belonging to each item.
+ *
+ * __v:   The vector.
+ * __key: A function or function-like macro that takes an item and returns
+ *        its string as a NUL terminated char * or const char *.
+ *
+ * Strings are ordered by their bytes as unsigned char, as by strcmp. The
+ * order of items with equal strings is unspecified. The sort needs room
+ * for 24 bytes per item plus a copy of the items, and leaves the vector
+ * unchanged apart from its error if that cannot be allocated.
+ */
+#define cvec_sort_strings_by(__v, __key)                                      \
+  do                                                                          \
+  {                                                                           \
+    struct __cvec_skey *__sk;                                                 \
+    __cvec_unshare(__v);                                                      \
+    if ((__v).__n < 2)                                                        \
+      break;                                                                  \
+    __sk = malloc((__v).__n * sizeof(*__sk));                                 \
+    if (!__sk)                                                                \
+    {                                                                         \
+      (__v).__e = CVEC_EOOM;                                                  \
+      break;                                                                  \
+    }                                                                         \
+    for (size_t __si = 0; __si < (__v).__n; ++__si)                           \
+    {                                                                         \
+      __sk[__si].__str = (const unsigned char *) __key((__v).__data[__si]);   \
+      __sk[__si].__idx = __si;                                                \
+    }                                                                         \
+    if (__cvec_sort_strings(__sk, (__v).__n, (__v).__data, (__v).__t) !=      \
+        CVEC_EOK)                                                             \
+      (__v).__e = CVEC_EOOM;                                                  \
+    free(__sk);                                                               \
+  } while (0)
+
+/*
+ * cvec_sort_strings: Sort a vector of strings.
+ *
+ * __v: A vector of NUL terminated char * or const char *.
+ *
+ * See cvec_sort_strings_by for the order and the memory used.
+ */
+#define cvec_sort_strings(__v) cvec_sort_strings_by(__v, __cvec_str_self)
+
+/*
+ * The assumed size of a cache line. Data written by different threads is
+ * kept this far apart so that the threads do not invalidate each other's
+ * caches.
+ */
+#ifndef CVEC_CACHE_LINE
+#define CVEC_CACHE_LINE 64
+#endif
+
+/*
+ * Sharded vectors, for many threads appending results that end up in one
+ * vector.
+ *
+ * A cvec_sharded_t holds one cvec_t per thread, each on cache lines of its
+ * own, so threads append to their shards without any synchronization and
+ * without slowing each other down. Collecting concatenates the shards onto
+ * a destination vector with at most one allocation of exactly the needed
+ * size, and leaves the shards empty but with their capacity, ready for the
+ * next round:
+ *
+ *    cvec_sharded_t(int) parts;
+ *    cvec_sharded_init(parts, int, nthreads);
+ *
+ *    (on thread i)
+ *    cvec_sharded_push_back(parts, i, result);
+ *
+ *    (after joining)
+ *    cvec_sharded_collect(all, parts);
+ *
+ * For large shards the copying can itself be split across threads: call
+ * cvec_sharded_collect_prepare once, then cvec_sharded_collect_shard for
+ * each shard from any thread.
+ */
+
+static inline void *
+__cvec_sharded_alloc(void **mem, size_t size, size_t n)
+{
+  uintptr_t p;
+
+  *mem = calloc(n * size + CVEC_CACHE_LINE, 1);
+  if (!*mem)
+    return NULL;
+  p = ((uintptr_t) *mem + CVEC_CACHE_LINE - 1) &
+      ~(uintptr_t) (CVEC_CACHE_LINE - 1);
+  return (void *) p;
+}
+
+/*
+ * cvec_sharded_t: Declare a new sharded vector type.
+ *
+ * __T: The type of items that the vector contains.
+ */
+#define cvec_sharded_t(__T)                                                   \
+  struct                                                                      \
+  {                                                                           \
+    struct                                                                    \
+    {                                                                         \
+      cvec_t(__T) __v;                                                        \
+      size_t __off;                                                           \
+      char __pad[CVEC_CACHE_LINE -                                            \
+                 (sizeof(cvec_t(__T)) + sizeof(size_t)) % CVEC_CACHE_LINE];   \
+    } *__shards;                                                              \
+    void *__mem;                                                              \
+    size_t __nshards;                                                         \
+    int __e;                                                                  \
+  }
+
+/*
+ * cvec_sharded_init: Initializes a sharded vector with empty shards.
+ *
+ * __s:     The sharded vector to initialize.
+ * __T:     The type of items that the vector contains.
+ * __count: The number of shards, usually one per thread.
+ *
+ * The shards have no sentinel value and no __on_free function, since their
+ * items are moved rather than destroyed.
+ */
+#define cvec_sharded_init(__s, __T, __count)                                  \
+  do                                                                          \
+  {                                                                           \
+    (__s).__nshards = (__count);                                              \
+    (__s).__shards = __cvec_sharded_alloc(                                    \
+        &(__s).__mem, sizeof(*(__s).__shards), (__s).__nshards);              \
+    (__s).__e = CVEC_EOK;                                                     \
+    if (!(__s).__shards)                                                      \
+    {                                                                         \
+      (__s).__nshards = 0;                                                    \
+      (__s).__e = CVEC_EOOM;                                                  \
+    }                                                                         \
+    for (size_t __i = 0; __i < (__s).__nshards; ++__i)                        \
+      (__s).__shards[__i].__v.__t = sizeof(__T);                              \
+  } while (0)
+
+/*
+ * cvec_sharded_free: Deallocates all the memory of a sharded vector.
+ *
+ * __s: The sharded vector.
+ */
+#define cvec_sharded_free(__s)                                                \
+  do                                                                          \
+  {                                                                           \
+    for (size_t __i = 0; __i < (__s).__nshards; ++__i)                        \
+      cvec_free((__s).__shards[__i].__v);                                     \
+    free((__s).__mem);                                                        \
+    (__s).__mem = NULL;                                                       \
+    (__s).__shards = NULL;                                                    \
+    (__s).__nshards = 0;                                                      \
+  } while (0)
+
+/*
+ * cvec_sharded_shard: Returns the vector of a shard. Any vector operation
+ * can be used on it, but only by one thread at a time.
+ *
+ * __s: The sharded vector.
+ * __i: The index of the shard.
+ */
+#define cvec_sharded_shard(__s, __i) ((__s).__shards[(__i)].__v)
+
+/*
+ * cvec_sharded_push_back: Add an item to the end of a shard.
+ *
+ * __s:    The sharded vector.
+ * __i:    The index of the shard.
+ * __item: The item to add.
+ */
+#define cvec_sharded_push_back(__s, __i, __item)                              \
+  cvec_push_back(cvec_sharded_shard(__s, __i), (__item))
+
+/*
+ * cvec_sharded_collect_prepare: Make room for all shards at the end of a
+ * vector and decide where each shard goes.
+ *
+ * __dst: The vector to append the shards to.
+ * __s:   The sharded vector.
+ *
+ * The size of __dst includes the shards from here on, but their items are
+ * only copied by cvec_sharded_collect_shard. If the room cannot be
+ * allocated, __dst is unchanged apart from its error, and collecting the
+ * shards does nothing. An error in any shard is passed on to __dst.
+ */
+#define cvec_sharded_collect_prepare(__dst, __s)                              \
+  do                                                                          \
+  {                                                                           \
+    size_t __sn = (__dst).__n;                                                \
+    for (size_t __i = 0; __i < (__s).__nshards; ++__i)                        \
+    {                                                                         \
+      (__s).__shards[__i].__off = CVEC_NPOS;                                  \
+      if ((__s).__shards[__i].__v.__e != CVEC_EOK)                            \
+        (__dst).__e = (__s).__shards[__i].__v.__e;                            \
+      __sn += (__s).__shards[__i].__v.__n;                                    \
+    }                                                                         \
+    __cvec_unshare(__dst);                                                    \
+    if (__sn > (__dst).__m)                                                   \
+    {                                                                         \
+      void *__sd = realloc((__dst).__data, (__dst).__t * __sn);               \
+      if (!__sd)                                                              \
+      {                                                                       \
+        (__dst).__e = CVEC_EOOM;                                              \
+        break;                                                                \
+      }                                                                       \
+      (__dst).__data = __sd;                                                  \
+      (__dst).__m = __sn;                                                     \
+    }                                                                         \
+    __sn = (__dst).__n;                                                       \
+    for (size_t __i = 0; __i < (__s).__nshards; ++__i)                        \
+    {                                                                         \
+      (__s).__shards[__i].__off = __sn;                                       \
+      __sn += (__s).__shards[__i].__v.__n;                                    \
+    }                                                                         \
+    (__dst).__n = __sn;                                                       \
+  } while (0)
+
+/*
+ * cvec_sharded_collect_shard: Move the items of one shard into the room
+ * made for them by cvec_sharded_collect_prepare.
+ *
+ * __dst: The vector passed to cvec_sharded_collect_prepare.
+ * __s:   The sharded vector.
+ * __i:   The index of the shard.
+ *
+ * Different shards can be collected by different threads at the same time.
+ * The shard is left empty with its capacity unchanged.
+ */
+#define cvec_sharded_collect_shard(__dst, __s, __i)                           \
+  do                                                                          \
+  {                                                                           \
+    size_t __so = (__s).__shards[(__i)].__off;                                \
+    if (__so == CVEC_NPOS)                                                    \
+      break;                                                                  \
+    if ((__s).__shards[(__i)].__v.__n)                                        \
+      memcpy((__dst).__data + __so, (__s).__shards[(__i)].__v.__data,         \
+             (__dst).__t * (__s).__shards[(__i)].__v.__n);                    \
+    (__s).__shards[(__i)].__v.__n = 0;                                        \
+    (__s).__shards[(__i)].__off = CVEC_NPOS;                                  \
+  } while (0)
+
+/*
+ * cvec_sharded_collect: Move the items of all shards, in shard order, to
+ * the end of a vector.
+ *
+ * __dst: The vector to append the shards to.
+ * __s:   The sharded vector.
+ *
+ * __dst grows by at most one allocation, to exactly the size needed. The
+ * shards are left empty with their capacity unchanged.
+ */
+#define cvec_sharded_collect(__dst, __s)                                      \
+  do                                                                          \
+  {                                                                           \
+    cvec_sharded_collect_prepare(__dst, __s);                                 \
+    for (size_t __si = 0; __si < (__s).__nshards; ++__si)                     \
+      cvec_sharded_collect_shard(__dst, __s, __si);                           \
+  } while (0)
+
+#ifdef __CVEC_HAS_ATOMICS
+/*
+ * Published snapshots for vectors that are read far more often than they
+ * change (read-copy-update).
+ *
+ * A cvec_rcu_t holds one immutable version of a vector at a time. Readers
+ * take the current version without locking and without any atomic
+ * read-modify-write: entering a read section is a load, a store to the
+ * reader's own slot and a fence. A writer builds the next version in an
+ * ordinary cvec_t and publishes a copy of it, which readers see from their
+ * next read section on.
+ *
+ * Old versions are reclaimed by epochs. Each read section records the
+ * global epoch in the reader's slot, each publish retires the old version
+ * with the current epoch and then advances it, and a retired version is
+ * freed once no reader is inside a section that began at or before its
+ * epoch:
+ *
+ *    cvec_rcu_t(int) cfg;
+ *    cvec_rcu_init(cfg, int, -1, 64);
+ *
+ *    (on each reader thread)
+ *    cvec_rcu_reader_t(int) rd;
+ *    cvec_rcu_register(cfg, rd);
+ *    cvec_rcu_read_lock(cfg, rd);
+ *    for (size_t i = 0; i < cvec_rcu_size(rd); ++i)
+ *      use(cvec_rcu_get(rd, i));
+ *    cvec_rcu_read_unlock(cfg, rd);
+ *
+ *    (on a writer thread)
+ *    cvec_rcu_publish(cfg, new_items);
+ *
+ * A writer that wants to start from the current version reads it like any
+ * other reader. Publishing is serialized by a spin lock, so any number of
+ * threads may publish.
+ */
+
+/* A reader slot, one cache line each */
+struct __cvec_rcu_slot
+{
+  __cvec_atomic(uint64_t) __epoch;
+  __cvec_atomic(int) __used;
+  char __pad[CVEC_CACHE_LINE - sizeof(__cvec_atomic(uint64_t)) -
+             sizeof(__cvec_atomic(int))];
+};
+
+/* A version. The items follow after __CVEC_RCU_HDR bytes. */
+struct __cvec_rcu_ver
+{
+  size_t __n;
+  uint64_t __epoch;
+  struct __cvec_rcu_ver *__next;
+};
+
+#define __CVEC_RCU_HDR CVEC_CACHE_LINE
+
+/* The untyped part of a cvec_rcu_t */
+struct __cvec_rcu_base
+{
+  __cvec_atomic(struct __cvec_rcu_ver *) __cur;
+  __cvec_atomic(uint64_t) __epoch;
+  __cvec_atomic(int) __wlock;
+  size_t __t;
+  size_t __nslots;
+  struct __cvec_rcu_slot *__slots;
+  void *__mem;
+  struct __cvec_rcu_ver *__retired;
+};
+
+static inline struct __cvec_rcu_ver *
+__cvec_rcu_new_ver(size_t t, const void *data, size_t n)
+{
+  struct __cvec_rcu_ver *v = malloc(__CVEC_RCU_HDR + t * n);
+
+  if (!v)
+    return NULL;
+  v->__n = n;
+  v->__epoch = 0;
+  v->__next = NULL;
+  if (n)
+    memcpy((char *) v + __CVEC_RCU_HDR, data, t * n);
+  return v;
+}
+
+static inline int
+__cvec_rcu_init(struct __cvec_rcu_base *b, size_t t, size_t nslots)
+{
+  struct __cvec_rcu_ver *v = __cvec_rcu_new_ver(t, NULL, 0);
+  uintptr_t p;
+
+  memset(b, 0, sizeof(*b));
+  b->__mem = malloc((nslots + 1) * sizeof(struct __cvec_rcu_slot));
+  if (!v || !b->__mem)
+  {
+    free(v);
+    free(b->__mem);
+    b->__mem = NULL;
+    return CVEC_EOOM;
+  }
+  p = ((uintptr_t) b->__mem + CVEC_CACHE_LINE - 1) &
+      ~(uintptr_t) (CVEC_CACHE_LINE - 1);
+  b->__slots = (struct __cvec_rcu_slot *) p;
+  memset(b->__slots, 0, nslots * sizeof(struct __cvec_rcu_slot));
+  b->__nslots = nslots;
+  b->__t = t;
+  __cvec_store(&b->__epoch, 1, __CVEC_RELAXED);
+  __cvec_store(&b->__cur, v, __CVEC_RELEASE);
+  return CVEC_EOK;
+}
+
+static inline size_t
+__cvec_rcu_register(struct __cvec_rcu_base *b)
+{
+  for (size_t i = 0; i < b->__nslots; ++i)
+  {
+    int expected = 0;
+
+    if (__cvec_load(&b->__slots[i].__used, __CVEC_RELAXED))
+      continue;
+    /* The CAS is weak, so retry while the slot still reads as free */
+    while (!__cvec_cas(&b->__slots[i].__used, &expected, 1, __CVEC_ACQ_REL))
+    {
+      if (expected)
+        break;
+    }
+    if (!expected)
+      return i;
+  }
+  return CVEC_NPOS;
+}
+
+static inline struct __cvec_rcu_ver *
+__cvec_rcu_lock(struct __cvec_rcu_base *b, size_t slot)
+{
+  uint64_t e = __cvec_load(&b->__epoch, __CVEC_ACQUIRE);
+
+  __cvec_store(&b->__slots[slot].__epoch, e, __CVEC_RELAXED);
+  __cvec_fence(__CVEC_SEQ_CST);
+  return __cvec_load(&b->__cur, __CVEC_ACQUIRE);
+}
+
+/* Frees the retired versions no reader can still see. Needs the lock. */
+static inline void
+__cvec_rcu_reclaim_locked(struct __cvec_rcu_base *b)
+{
+  uint64_t min = UINT64_MAX;
+  struct __cvec_rcu_ver **pv = &b->__retired;
+
+  for (size_t i = 0; i < b->__nslots; ++i)
+  {
+    uint64_t e = __cvec_load(&b->__slots[i].__epoch, __CVEC_ACQUIRE);
+
+    if (e && e < min)
+      min = e;
+  }
+  while (*pv)
+  {
+    struct __cvec_rcu_ver *v = *pv;
+
+    if (v->__epoch < min)
+    {
+      *pv = v->__next;
+      free(v);
+    }
+    else
+      pv = &v->__next;
+  }
+}
+
+static inline void
+__cvec_rcu_wlock(struct __cvec_rcu_base *b)
+{
+  int expected = 0;
+
+  while (!__cvec_cas(&b->__wlock, &expected, 1, __CVEC_ACQUIRE))
+  {
+    expected = 0;
+    while (__cvec_load(&b->__wlock, __CVEC_RELAXED))
+      ;
+  }
+}
+
+static inline int
+__cvec_rcu_publish(struct __cvec_rcu_base *b, const void *data, size_t n)
+{
+  struct __cvec_rcu_ver *v = __cvec_rcu_new_ver(b->__t, data, n);
+  struct __cvec_rcu_ver *old;
+  uint64_t e;
+
+  if (!v)
+    return CVEC_EOOM;
+  __cvec_rcu_wlock(b);
+  old = __cvec_xchg(&b->__cur, v, __CVEC_SEQ_CST);
+  e = __cvec_load(&b->__epoch, __CVEC_RELAXED);
+  old->__epoch = e;
+  old->__next = b->__retired;
+  b->__retired = old;
+  __cvec_store(&b->__epoch, e + 1, __CVEC_RELEASE);
+  __cvec_fence(__CVEC_SEQ_CST);
+  __cvec_rcu_reclaim_locked(b);
+  __cvec_store(&b->__wlock, 0, __CVEC_RELEASE);
+  return CVEC_EOK;
+}
+
+static inline void
+__cvec_rcu_free(struct __cvec_rcu_base *b)
+{
+  struct __cvec_rcu_ver *v = b->__retired;
+
+  while (v)
+  {
+    struct __cvec_rcu_ver *next = v->__next;
+
+    free(v);
+    v = next;
+  }
+  free(__cvec_load(&b->__cur, __CVEC_RELAXED));
+  free(b->__mem);
+  memset(b, 0, sizeof(*b));
+}
+
+/*
+ * cvec_rcu_t: Declare a new published vector type.
+ *
+ * __T: The type of items that the vector contains.
+ */
+#define cvec_rcu_t(__T)                                                       \
+  struct                                                                      \
+  {                                                                           \
+    struct __cvec_rcu_base __b;                                               \
+    int __e;                                                                  \
+    __T __sentinel;                                                           \
+  }
+
+/*
+ * cvec_rcu_reader_t: Declare the reader handle type of a published vector.
+ *
+ * __T: The type of items that the vector contains.
+ *
+ * A reader handle belongs to one thread, and holds the version taken by
+ * cvec_rcu_read_lock until the matching cvec_rcu_read_unlock.
+ */
+#define cvec_rcu_reader_t(__T)                                                \
+  struct                                                                      \
+  {                                                                           \
+    const __T *__data;                                                        \
+    size_t __n;                                                               \
+    size_t __slot;                                                            \
+  }
+
+/*
+ * cvec_rcu_init: Initializes a published vector with no items.
+ *
+ * __r:              The published vector to initialize.
+ * __T:              The type of items that the vector contains.
+ * __sentinel_value: The value cvec_rcu_at returns out of bounds.
+ * __max_readers:    The number of reader threads that may be registered at
+ *                   the same time.
+ */
+#define cvec_rcu_init(__r, __T, __sentinel_value, __max_readers)              \
+  do                                                                          \
+  {                                                                           \
+    (__r).__e =                                                               \
+        __cvec_rcu_init(&(__r).__b, sizeof(__T), (__max_readers));            \
+    (__r).__sentinel = (__sentinel_value);                                    \
+  } while (0)
+
+/*
+ * cvec_rcu_free: Deallocates all the versions of a published vector.
+ *
+ * __r: The published vector.
+ *
+ * No reader may be inside a read section, or use the vector afterwards.
+ */
+#define cvec_rcu_free(__r) __cvec_rcu_free(&(__r).__b)
+
+/*
+ * cvec_rcu_register: Claim a reader slot for the calling thread.
+ *
+ * __r:  The published vector.
+ * __rd: The reader handle to set up.
+ *
+ * Returns non-zero on success, or zero if every slot is taken.
+ */
+#define cvec_rcu_register(__r, __rd)                                          \
+  (((__rd).__data = NULL, (__rd).__n = 0,                                     \
+    (__rd).__slot = __cvec_rcu_register(&(__r).__b)) != CVEC_NPOS)
+
+/*
+ * cvec_rcu_unregister: Give a reader slot back.
+ *
+ * __r:  The published vector.
+ * __rd: The reader handle, outside of a read section.
+ */
+#define cvec_rcu_unregister(__r, __rd)                                        \
+  __cvec_store(&(__r).__b.__slots[(__rd).__slot].__used, 0, __CVEC_RELEASE)
+
+/*
+ * cvec_rcu_read_lock: Begin a read section and take the current version.
+ *
+ * __r:  The published vector.
+ * __rd: A registered reader handle.
+ *
+ * The version stays valid and unchanged until cvec_rcu_read_unlock, even if
+ * a newer one is published in the meantime. Read sections of one handle
+ * must not be nested.
+ */
+#define cvec_rcu_read_lock(__r, __rd)                                         \
+  do                                                                          \
+  {                                                                           \
+    struct __cvec_rcu_ver *__rv =                                             \
+        __cvec_rcu_lock(&(__r).__b, (__rd).__slot);                           \
+    (__rd).__data = (void *) ((char *) __rv + __CVEC_RCU_HDR);                \
+    (__rd).__n = __rv->__n;                                                   \
+  } while (0)
+
+/*
+ * cvec_rcu_read_unlock: End a read section.
+ *
+ * __r:  The published vector.
+ * __rd: The reader handle.
+ */
+#define cvec_rcu_read_unlock(__r, __rd)                                       \
+  __cvec_store(&(__r).__b.__slots[(__rd).__slot].__epoch, 0, __CVEC_RELEASE)
+
+/*
+ * cvec_rcu_size: Returns the number of items in the version a reader holds.
+ *
+ * __rd: The reader handle, inside a read section.
+ */
+#define cvec_rcu_size(__rd) (__rd).__n
+
+/*
+ * cvec_rcu_data: Returns a pointer to the items of the version a reader
+ *                holds.
+ *
+ * __rd: The reader handle, inside a read section.
+ */
+#define cvec_rcu_data(__rd) (__rd).__data
+
+/*
+ * cvec_rcu_get: Returns an item of the version a reader holds.
+ *
+ * __rd: The reader handle, inside a read section.
+ * __i:  The position of the requested item.
+ *
+ * Note that no bounds checking is performed here.
+ */
+#define cvec_rcu_get(__rd, __i) (__rd).__data[(__i)]
+
+/*
+ * cvec_rcu_at: Returns an item of the version a reader holds.
+ *
+ * __r:  The published vector.
+ * __rd: The reader handle, inside a read section.
+ * __i:  The position of the requested item.
+ *
+ * If __i is out of bounds then the sentinel value is returned.
+ */
+#define cvec_rcu_at(__r, __rd, __i)                                           \
+  ((__i) < (__rd).__n ? (__rd).__data[(__i)] : (__r).__sentinel)
+
+/*
+ * cvec_rcu_publish: Replace the current version with a copy of a vector.
+ *
+ * __r: The published vector.
+ * __v: A cvec_t holding the items of the new version.
+ *
+ * The old version is freed once no reader can see it any more, either
+ * here or by a later publish or cvec_rcu_reclaim.
+ */
+#define cvec_rcu_publish(__r, __v)                                            \
+  do                                                                          \
+  {                                                                           \
+    if (__cvec_rcu_publish(&(__r).__b, (__v).__data, (__v).__n) !=            \
+        CVEC_EOK)                                                             \
+      (__r).__e = CVEC_EOOM;                                                  \
+  } while (0)
+
+/*
+ * cvec_rcu_reclaim: Free the old versions that no reader can see any more.
+ *
+ * __r: The published vector.
+ */
+#define cvec_rcu_reclaim(__r)                                                 \
+  do                                                                          \
+  {                                                                           \
+    __cvec_rcu_wlock(&(__r).__b);                                             \
+    __cvec_rcu_reclaim_locked(&(__r).__b);                                    \
+    __cvec_store(&(__r).__b.__wlock, 0, __CVEC_RELEASE);                      \
+  } while (0)
+#endif /* __CVEC_HAS_ATOMICS */
+
 #endif /* __CVEC_H__ */
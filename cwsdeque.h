@@ -0,0 +1,366 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 Nathan Forbes
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * A work-stealing deque, after Chase and Lev. One thread owns the deque and
+ * pushes and pops items at the bottom, as a stack. Any other thread may
+ * steal the oldest item from the top. The owner needs no read-modify-write
+ * operation except when it races a thief for the last item, so a scheduler
+ * thread can keep its own work local and cheap while idle threads take
+ * what it cannot get to.
+ *
+ *    cwsdeque_t(struct task) d;
+ *    cwsdeque_init(d, struct task, 64);
+ *
+ *    (owner)                             (other threads)
+ *    cwsdeque_push(d, t);                struct task u;
+ *    while (cwsdeque_pop(d, t))          if (cwsdeque_steal(d, u))
+ *      run(&t);                            run(&u);
+ *
+ * The ring grows when the owner fills it. Thieves may still be reading the
+ * old ring, so it is retired rather than freed: the owner frees retired
+ * rings once it sees that no steal is in progress, and cwsdeque_free frees
+ * whatever is left. Retired rings together are never larger than the
+ * current one.
+ *
+ * Errors are reported through the same field as cvec_t, so cvec_had_error,
+ * cvec_error and cvec_strerror work on deques too.
+ */
+
+#ifndef __CWSDEQUE_H__
+#define __CWSDEQUE_H__
+
+#include "cvec.h"
+
+#ifndef __CVEC_HAS_ATOMICS
+#error "cwsdeque.h needs C11 atomics or the GCC/Clang __atomic builtins"
+#endif
+
+/* A ring. The items follow after CVEC_CACHE_LINE bytes. */
+struct __cwsdeque_ring
+{
+  size_t __mask;
+  struct __cwsdeque_ring *__next;
+};
+
+/*
+ * The untyped part of a deque. Thieves write __top and __thieves, and the
+ * owner writes __bottom and __ring. The struct need not start on a cache
+ * line, so a full line of padding around each pair keeps them off each
+ * other's lines.
+ */
+struct __cwsdeque_base
+{
+  char __pad0[CVEC_CACHE_LINE];
+  __cvec_atomic(size_t) __top;
+  __cvec_atomic(size_t) __thieves;
+  char __pad1[CVEC_CACHE_LINE];
+  __cvec_atomic(size_t) __bottom;
+  __cvec_atomic(struct __cwsdeque_ring *) __ring;
+  char __pad2[CVEC_CACHE_LINE];
+  struct __cwsdeque_ring *__retired;
+  size_t __t;
+};
+
+/*
+ * The item at position p of a ring.
+ */
+#define __cwsdeque_slot(__r, __t, __p)                                        \
+  ((char *) (__r) + CVEC_CACHE_LINE + ((__p) & (__r)->__mask) * (__t))
+
+/*
+ * Whether position a is before position b. The positions are free-running
+ * counters, and the owner briefly moves the bottom below the top when it
+ * pops from an empty deque.
+ */
+#define __cwsdeque_before(__a, __b) ((__b) - (__a) - 1 < SIZE_MAX / 2)
+
+static inline struct __cwsdeque_ring *
+__cwsdeque_new_ring(size_t t, size_t cap)
+{
+  struct __cwsdeque_ring *r = malloc(CVEC_CACHE_LINE + t * cap);
+
+  if (r)
+  {
+    r->__mask = cap - 1;
+    r->__next = NULL;
+  }
+  return r;
+}
+
+static inline int
+__cwsdeque_init(struct __cwsdeque_base *b, size_t t, size_t cap)
+{
+  size_t m = 2;
+
+  while (m < cap)
+    m <<= 1;
+  memset(b, 0, sizeof(*b));
+  b->__t = t;
+  __cvec_store(&b->__ring, __cwsdeque_new_ring(t, m), __CVEC_RELAXED);
+  return __cvec_load(&b->__ring, __CVEC_RELAXED) ? CVEC_EOK : CVEC_EOOM;
+}
+
+/* Owner side: frees the retired rings if no thief can be reading them */
+static inline void
+__cwsdeque_reclaim(struct __cwsdeque_base *b)
+{
+  if (__cvec_load(&b->__thieves, __CVEC_SEQ_CST))
+    return;
+  while (b->__retired)
+  {
+    struct __cwsdeque_ring *r = b->__retired;
+
+    b->__retired = r->__next;
+    free(r);
+  }
+}
+
+/* Owner side: moves the items into a ring twice the size */
+static inline int
+__cwsdeque_grow(struct __cwsdeque_base *b, struct __cwsdeque_ring **pr,
+                size_t top, size_t bottom)
+{
+  struct __cwsdeque_ring *old = *pr;
+  struct __cwsdeque_ring *r;
+
+  r = __cwsdeque_new_ring(b->__t, 2 * (old->__mask + 1));
+
+  if (!r)
+    return CVEC_EOOM;
+  for (size_t p = top; p != bottom; ++p)
+    memcpy(__cwsdeque_slot(r, b->__t, p), __cwsdeque_slot(old, b->__t, p),
+           b->__t);
+  __cvec_store(&b->__ring, r, __CVEC_SEQ_CST);
+  old->__next = b->__retired;
+  b->__retired = old;
+  __cwsdeque_reclaim(b);
+  *pr = r;
+  return CVEC_EOK;
+}
+
+static inline int
+__cwsdeque_push(struct __cwsdeque_base *b, const void *item)
+{
+  size_t t = b->__t;
+  size_t bottom = __cvec_load(&b->__bottom, __CVEC_RELAXED);
+  size_t top = __cvec_load(&b->__top, __CVEC_ACQUIRE);
+  struct __cwsdeque_ring *r = __cvec_load(&b->__ring, __CVEC_RELAXED);
+
+  if (bottom - top > r->__mask && __cwsdeque_grow(b, &r, top, bottom))
+    return CVEC_EOOM;
+  memcpy(__cwsdeque_slot(r, t, bottom), item, t);
+  __cvec_store(&b->__bottom, bottom + 1, __CVEC_RELEASE);
+  return CVEC_EOK;
+}
+
+static inline int
+__cwsdeque_pop(struct __cwsdeque_base *b, void *item)
+{
+  size_t t = b->__t;
+  size_t bottom = __cvec_load(&b->__bottom, __CVEC_RELAXED) - 1;
+  struct __cwsdeque_ring *r = __cvec_load(&b->__ring, __CVEC_RELAXED);
+  size_t top;
+  int won = 1;
+
+  __cvec_store(&b->__bottom, bottom, __CVEC_RELAXED);
+  __cvec_fence(__CVEC_SEQ_CST);
+  top = __cvec_load(&b->__top, __CVEC_RELAXED);
+  if (__cwsdeque_before(bottom, top))
+  {
+    __cvec_store(&b->__bottom, bottom + 1, __CVEC_RELAXED);
+    return 0;
+  }
+  if (top == bottom)
+  {
+    /* The last item: take it from the thieves by moving the top instead */
+    size_t expected = top;
+
+    while (!__cvec_cas(&b->__top, &expected, top + 1, __CVEC_SEQ_CST) &&
+           expected == top)
+      ;
+    won = expected == top;
+    __cvec_store(&b->__bottom, bottom + 1, __CVEC_RELAXED);
+  }
+  if (won)
+    memcpy(item, __cwsdeque_slot(r, t, bottom), t);
+  return won;
+}
+
+static inline int
+__cwsdeque_steal(struct __cwsdeque_base *b, void *item)
+{
+  size_t t = b->__t;
+  size_t top, bottom, expected;
+  int won = 0;
+
+  __cvec_fetch_add(&b->__thieves, 1, __CVEC_SEQ_CST);
+  top = __cvec_load(&b->__top, __CVEC_ACQUIRE);
+  __cvec_fence(__CVEC_SEQ_CST);
+  bottom = __cvec_load(&b->__bottom, __CVEC_ACQUIRE);
+  if (__cwsdeque_before(top, bottom))
+  {
+    struct __cwsdeque_ring *r = __cvec_load(&b->__ring, __CVEC_ACQUIRE);
+
+    /*
+     * If another thief moves the top past this slot first, the owner may
+     * reuse it while it is being copied. The CAS below then fails and the
+     * copy is discarded, which is why a lost steal may still write __item.
+     */
+    memcpy(item, __cwsdeque_slot(r, t, top), t);
+    expected = top;
+    while (!__cvec_cas(&b->__top, &expected, top + 1, __CVEC_SEQ_CST) &&
+           expected == top)
+      ;
+    won = expected == top;
+  }
+  __cvec_fetch_sub(&b->__thieves, 1, __CVEC_RELEASE);
+  return won;
+}
+
+static inline void
+__cwsdeque_free(struct __cwsdeque_base *b)
+{
+  free(__cvec_load(&b->__ring, __CVEC_RELAXED));
+  __cvec_store(&b->__ring, NULL, __CVEC_RELAXED);
+  while (b->__retired)
+  {
+    struct __cwsdeque_ring *r = b->__retired;
+
+    b->__retired = r->__next;
+    free(r);
+  }
+}
+
+static inline size_t
+__cwsdeque_size(size_t top, size_t bottom)
+{
+  return __cwsdeque_before(top, bottom) ? bottom - top : 0;
+}
+
+/*
+ * cwsdeque_t: Declare a new deque type.
+ *
+ * __T: The type of items that the deque holds.
+ *
+ * __own is the owner's scratch item, which push and pop go through so the
+ * item is converted to __T as by assignment.
+ */
+#define cwsdeque_t(__T)                                                       \
+  struct                                                                      \
+  {                                                                           \
+    struct __cwsdeque_base __b;                                               \
+    __T __own;                                                                \
+    int __e;                                                                  \
+  }
+
+/*
+ * cwsdeque_init: Initializes an empty deque.
+ *
+ * __d:   The deque to initialize.
+ * __T:   The type of items that the deque holds.
+ * __cap: The number of items the deque holds before it first grows. This
+ *        is rounded up to a power of two.
+ */
+#define cwsdeque_init(__d, __T, __cap)                                        \
+  do                                                                          \
+  {                                                                           \
+    (__d).__e = __cwsdeque_init(&(__d).__b, sizeof(__T), (__cap));            \
+  } while (0)
+
+/*
+ * cwsdeque_free: Deallocates the rings of a deque.
+ *
+ * __d: The deque, which no thread may use afterwards.
+ */
+#define cwsdeque_free(__d) __cwsdeque_free(&(__d).__b)
+
+/*
+ * cwsdeque_push: Add an item at the bottom of the deque.
+ *
+ * __d:    The deque. Only the owner thread may call this.
+ * __item: The item to add.
+ *
+ * If the ring is full and a bigger one cannot be allocated, the item is
+ * not added and the error is recorded in the deque.
+ */
+#define cwsdeque_push(__d, __item)                                            \
+  do                                                                          \
+  {                                                                           \
+    (__d).__own = (__item);                                                   \
+    if (__cwsdeque_push(&(__d).__b, &(__d).__own))                            \
+      (__d).__e = CVEC_EOOM;                                                  \
+  } while (0)
+
+/*
+ * cwsdeque_pop: Remove the item at the bottom of the deque, which is the
+ * one pushed last.
+ *
+ * __d:    The deque. Only the owner thread may call this.
+ * __item: An lvalue to store the removed item in.
+ *
+ * Returns non-zero if an item was removed, or zero if the deque is empty.
+ */
+#define cwsdeque_pop(__d, __item)                                             \
+  (__cwsdeque_pop(&(__d).__b, &(__d).__own) ? ((__item) = (__d).__own, 1) : 0)
+
+/*
+ * cwsdeque_steal: Remove the item at the top of the deque, which is the
+ * oldest one.
+ *
+ * __d:    The deque. Any thread but the owner may call this.
+ * __item: An lvalue of the type the deque holds, to store the removed item
+ *         in.
+ *
+ * Returns non-zero if an item was removed, or zero if the deque is empty
+ * or another thread took the item first. In the second case __item may
+ * still have been written to.
+ */
+#define cwsdeque_steal(__d, __item)                                           \
+  (__cvec_check_item(&(__item), &(__d).__own),                                \
+   __cwsdeque_steal(&(__d).__b, &(__item)))
+
+/*
+ * cwsdeque_reclaim: Frees the rings retired by growing, unless a steal is
+ * in progress. The deque also tries this each time it grows.
+ *
+ * __d: The deque. Only the owner thread may call this.
+ */
+#define cwsdeque_reclaim(__d) __cwsdeque_reclaim(&(__d).__b)
+
+/*
+ * cwsdeque_size: Returns the number of items in the deque.
+ *
+ * __d: The deque.
+ *
+ * When other threads are active this is only a snapshot.
+ */
+#define cwsdeque_size(__d)                                                    \
+  __cwsdeque_size(__cvec_load(&(__d).__b.__top, __CVEC_ACQUIRE),              \
+                  __cvec_load(&(__d).__b.__bottom, __CVEC_ACQUIRE))
+
+#undef __cwsdeque_slot
+#undef __cwsdeque_before
+
+#endif /* __CWSDEQUE_H__ */